@@ -19,22 +19,10 @@ bool GenerateNormalsPoly(
     if (dst.size() != points.size()) {
         return false;
     }
-    dst.zeroclear();
 
-    size_t num_faces = counts.size();
-    for (size_t fi = 0; fi < num_faces; ++fi)
-    {
-        int count = counts[fi];
-        const int *face = &indices[offsets[fi]];
-        float3 p0 = points[face[0]];
-        float3 p1 = points[face[1]];
-        float3 p2 = points[face[2]];
-        float3 n = cross(p1 - p0, p2 - p0);
-        for (int ci = 0; ci < count; ++ci) {
-            dst[face[ci]] += n;
-        }
-    }
-    Normalize(dst.data(), dst.size());
+    ConnectionData connection;
+    connection.buildConnection(indices, counts, offsets, points);
+    GenerateNormalsWithConnection(dst, points, indices, counts, offsets, connection);
     return true;
 }
 
@@ -214,11 +202,56 @@ void ConnectionData::clear()
     weld_indices.clear();
 }
 
+void ConnectionData::buildWeldMap(const IArray<float3>& vertices)
+{
+    const float eps = 0.0000001f;
+
+    int n = (int)vertices.size();
+    weld_map.resize_discard(n);
+    weld_counts.resize_discard(n);
+    weld_offsets.resize_discard(n);
+    weld_indices.resize_discard(n);
+
+    // vertices at the same position are in the same or neighbor cells
+    PointGrid grid;
+    grid.build(vertices.data(), n);
+    parallel_for_blocked(0, n, 1024, [&](int vi, int vend) {
+        for (; vi < vend; ++vi) {
+            int r = vi;
+            float3 p = vertices[vi];
+            grid.eachPointInBox(p - eps, p + eps, [&](int i) {
+                if (i < r && length(vertices[i] - p) < eps) {
+                    r = i;
+                }
+            });
+            weld_map[vi] = r;
+        }
+    });
+
+    weld_counts.zeroclear();
+    for (int vi : weld_map) {
+        weld_counts[vi]++;
+    }
+
+    int offset = 0;
+    for (int vi = 0; vi < n; ++vi) {
+        weld_offsets[vi] = offset;
+        offset += weld_counts[vi];
+    }
+
+    weld_counts.zeroclear();
+    for (int vi = 0; vi < n; ++vi) {
+        int mvi = weld_map[vi];
+        int i = weld_offsets[mvi] + weld_counts[mvi]++;
+        weld_indices[i] = vi;
+    }
+}
+
 void ConnectionData::buildConnection(
     const IArray<int>& indices_, int ngon_, const IArray<float3>& vertices_, bool welding)
 {
     if (welding) {
-        impl::BuildWeldMap(*this, vertices_);
+        buildWeldMap(vertices_);
 
         impl::IndicesW indices__{ indices_, weld_map };
         impl::CountsC counts_{ ngon_, indices_.size()/ngon_ };
@@ -234,7 +267,7 @@ void ConnectionData::buildConnection(
     const IArray<int>& indices_, const IArray<int>& counts_, const IArray<int>& /*offsets_*/, const IArray<float3>& vertices_, bool welding)
 {
     if (welding) {
-        impl::BuildWeldMap(*this, vertices_);
+        buildWeldMap(vertices_);
 
         impl::IndicesW vi{ indices_, weld_map };
         impl::BuildConnection(*this, vi, counts_, vertices_);
@@ -245,6 +278,23 @@ void ConnectionData::buildConnection(
 }
 
 
+void GenerateNormalsWithConnection(IArray<float3> dst, const IArray<float3>& vertices,
+    const IArray<int>& indices, int ngon, const ConnectionData& connection,
+    NormalWeighting weighting, bool flip)
+{
+    impl::CountsC counts{ ngon, indices.size() / ngon };
+    impl::OffsetsC offsets{ ngon, indices.size() / ngon };
+    impl::GenerateNormalsWithConnectionImpl(dst, vertices, indices, counts, offsets, connection, weighting, flip);
+}
+
+void GenerateNormalsWithConnection(IArray<float3> dst, const IArray<float3>& vertices,
+    const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const ConnectionData& connection,
+    NormalWeighting weighting, bool flip)
+{
+    impl::GenerateNormalsWithConnectionImpl(dst, vertices, indices, counts, offsets, connection, weighting, flip);
+}
+
+
 bool OnEdge(const IArray<int>& indices, int ngon, const IArray<float3>& vertices, const ConnectionData& connection, int vertex_index)
 {
     impl::CountsC counts{ ngon, indices.size() / ngon };
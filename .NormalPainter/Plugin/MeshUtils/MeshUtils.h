@@ -52,6 +52,8 @@ struct ConnectionData
     RawVector<int> weld_indices;
 
     void clear();
+    // weld_map[vi] is the smallest index of vertices at the same position (vi itself if there is none)
+    void buildWeldMap(const IArray<float3>& vertices);
     void buildConnection(
         const IArray<int>& indices, int ngon, const IArray<float3>& vertices, bool welding = false);
     void buildConnection(
@@ -80,6 +82,22 @@ struct ConnectionData
     }
 };
 
+enum class NormalWeighting
+{
+    Area,   // by area of faces (cross product of the first triangle of each face). same as GenerateNormalsPoly()
+    Angle,  // by angle of face corners at the vertex
+};
+
+// vertex normals gathered from connected faces in parallel. results don't depend on the number of threads.
+// dst and vertices must have the same size.
+// connection: built by ConnectionData::buildConnection(indices, ngon, vertices) (not welded)
+void GenerateNormalsWithConnection(IArray<float3> dst, const IArray<float3>& vertices,
+    const IArray<int>& indices, int ngon, const ConnectionData& connection,
+    NormalWeighting weighting = NormalWeighting::Area, bool flip = false);
+void GenerateNormalsWithConnection(IArray<float3> dst, const IArray<float3>& vertices,
+    const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const ConnectionData& connection,
+    NormalWeighting weighting = NormalWeighting::Area, bool flip = false);
+
 bool OnEdge(const IArray<int>& indices, int ngon, const IArray<float3>& vertices, const ConnectionData& connection, int vertex_index);
 bool OnEdge(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices, const ConnectionData& connection, int vertex_index);
 
@@ -89,6 +107,10 @@ bool IsEdgeOpened(const IArray<int>& indices, const IArray<int>& counts, const I
 template<class Handler>
 void SelectEdge(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
+// connection: built by ConnectionData::buildConnection(indices, ngon, vertices)
+template<class Handler>
+void SelectEdge(const IArray<int>& indices, int ngon, const IArray<float3>& vertices, const ConnectionData& connection,
+    const IArray<int>& vertex_indices, const Handler& handler);
 template<class Handler>
 void SelectEdge(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
@@ -96,6 +118,10 @@ void SelectEdge(const IArray<int>& indices, const IArray<int>& counts, const IAr
 template<class Handler>
 void SelectHole(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
+// connection: built by ConnectionData::buildConnection(indices, ngon, vertices, true) (welded)
+template<class Handler>
+void SelectHole(const IArray<int>& indices, int ngon, const IArray<float3>& vertices, const ConnectionData& connection,
+    const IArray<int>& vertex_indices, const Handler& handler);
 template<class Handler>
 void SelectHole(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
@@ -103,6 +129,10 @@ void SelectHole(const IArray<int>& indices, const IArray<int>& counts, const IAr
 template<class Handler>
 void SelectConnected(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
+// connection: built by ConnectionData::buildConnection(indices, ngon, vertices)
+template<class Handler>
+void SelectConnected(const IArray<int>& indices, int ngon, const IArray<float3>& vertices, const ConnectionData& connection,
+    const IArray<int>& vertex_indices, const Handler& handler);
 template<class Handler>
 void SelectConnected(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
@@ -339,3 +369,5 @@ inline uint32_t Float4ToColor32(const float4& c)
 
 #include "MeshUtils_impl.h"
 #include "muMeshRefiner.h"
+#include "muBVH.h"
+#include "muPointGrid.h"
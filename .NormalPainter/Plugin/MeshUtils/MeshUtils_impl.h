@@ -78,49 +78,107 @@ inline void BuildConnection(
     }
 }
 
-inline void BuildWeldMap(
-    ConnectionData& connection, const IArray<float3>& vertices)
+#define muNormalsTileSize 64
+
+template<class Counts, class Offsets>
+inline void GenerateNormalsWithConnectionImpl(
+    IArray<float3> dst, const IArray<float3>& vertices,
+    const IArray<int>& indices, const Counts& counts, const Offsets& offsets, const ConnectionData& connection,
+    NormalWeighting weighting, bool flip)
 {
-    auto& weld_map = connection.weld_map;
-    auto& weld_counts = connection.weld_counts;
-    auto& weld_offsets = connection.weld_offsets;
-    auto& weld_indices = connection.weld_indices;
-
-    int n = (int)vertices.size();
-    weld_map.resize_discard(n);
-    weld_counts.resize_discard(n);
-    weld_offsets.resize_discard(n);
-    weld_indices.resize_discard(n);
-
-    parallel_for(0, n, [&](int vi) {
-        int r = vi;
-        float3 p = vertices[vi];
-        for (int i = 0; i < vi; ++i) {
-            if (length(vertices[i] - p) < 0.0000001f) {
-                r = i;
-                break;
+    int num_faces = (int)counts.size();
+    int num_vertices = (int)dst.size();
+    bool angle_weighted = weighting == NormalWeighting::Angle;
+    float sign = flip ? -1.0f : 1.0f;
+
+    // face normals: cross product of the first triangle of each face.
+    // positions are gathered into SoA tiles so that compilers can vectorize the math.
+    RawVector<float3> face_normals;
+    RawVector<float> corner_weights;
+    face_normals.resize_discard(num_faces);
+    if (angle_weighted) {
+        corner_weights.resize_discard(indices.size());
+    }
+
+    parallel_for_blocked(0, num_faces, 1024, [&](int fbegin, int fend) {
+        float e1x[muNormalsTileSize], e1y[muNormalsTileSize], e1z[muNormalsTileSize];
+        float e2x[muNormalsTileSize], e2y[muNormalsTileSize], e2z[muNormalsTileSize];
+        float nx[muNormalsTileSize], ny[muNormalsTileSize], nz[muNormalsTileSize];
+        for (int bf = fbegin; bf < fend; bf += muNormalsTileSize) {
+            int n = std::min<int>(fend - bf, muNormalsTileSize);
+            for (int k = 0; k < n; ++k) {
+                const int *face = &indices[offsets[bf + k]];
+                float3 p0 = vertices[face[0]];
+                float3 e1 = vertices[face[1]] - p0;
+                float3 e2 = vertices[face[2]] - p0;
+                e1x[k] = e1.x; e1y[k] = e1.y; e1z[k] = e1.z;
+                e2x[k] = e2.x; e2y[k] = e2.y; e2z[k] = e2.z;
+            }
+            for (int k = 0; k < n; ++k) {
+                nx[k] = (e1y[k] * e2z[k] - e1z[k] * e2y[k]) * sign;
+                ny[k] = (e1z[k] * e2x[k] - e1x[k] * e2z[k]) * sign;
+                nz[k] = (e1x[k] * e2y[k] - e1y[k] * e2x[k]) * sign;
+            }
+            if (angle_weighted) {
+                for (int k = 0; k < n; ++k) {
+                    // zero-area faces get zero normals. 1 / sqrt(0) * 0 would be NaN and spread to all their vertices.
+                    // the guard is a select rather than a branch to keep the loop vectorizable.
+                    float l2 = nx[k] * nx[k] + ny[k] * ny[k] + nz[k] * nz[k];
+                    float nonzero = (float)(l2 > 0.0f);
+                    float rl = nonzero / std::sqrt(l2 + (1.0f - nonzero));
+                    nx[k] *= rl; ny[k] *= rl; nz[k] *= rl;
+                }
+            }
+            for (int k = 0; k < n; ++k) {
+                face_normals[bf + k] = { nx[k], ny[k], nz[k] };
             }
         }
-        weld_map[vi] = r;
-    });
 
-    weld_counts.zeroclear();
-    for (int vi : weld_map) {
-        weld_counts[vi]++;
-    }
+        if (angle_weighted && fbegin < fend) {
+            // weight of each corner: angle between its two edges. cosines first, then acos in a flat loop.
+            for (int fi = fbegin; fi < fend; ++fi) {
+                int c = counts[fi];
+                int fo = offsets[fi];
+                const int *face = &indices[fo];
+                for (int ci = 0; ci < c; ++ci) {
+                    float3 p = vertices[face[ci]];
+                    float3 e1 = vertices[face[ci == 0 ? c - 1 : ci - 1]] - p;
+                    float3 e2 = vertices[face[ci == c - 1 ? 0 : ci + 1]] - p;
+                    float d = length_sq(e1) * length_sq(e2);
+                    // degenerated corners get angle 0
+                    corner_weights[fo + ci] = d > 0.0f ? clamp(dot(e1, e2) / std::sqrt(d), -1.0f, 1.0f) : 1.0f;
+                }
+            }
 
-    int offset = 0;
-    for (int vi = 0; vi < n; ++vi) {
-        weld_offsets[vi] = offset;
-        offset += weld_counts[vi];
-    }
+            // polynomial acos (error < 7e-5 rad) so that the loop can be vectorized
+            float *w = &corner_weights[offsets[fbegin]];
+            int num_corners = offsets[fend - 1] + counts[fend - 1] - offsets[fbegin];
+            const float half_pi = 1.5707963f;
+            for (int i = 0; i < num_corners; ++i) {
+                float x = std::abs(w[i]);
+                float r = (((-0.0187293f * x + 0.0742610f) * x - 0.2121144f) * x + 1.5707288f) * std::sqrt(1.0f - x);
+                w[i] = half_pi + std::copysign(1.0f, w[i]) * (r - half_pi);
+            }
+        }
+    });
 
-    weld_counts.zeroclear();
-    for (int vi = 0; vi < n; ++vi) {
-        int mvi = weld_map[vi];
-        int i = weld_offsets[mvi] + weld_counts[mvi]++;
-        weld_indices[i] = vi;
-    }
+    // gather. each vertex sums its faces in the order of the connection, so results don't depend on threads.
+    parallel_for_blocked(0, num_vertices, 1024, [&](int vi, int vend) {
+        for (; vi < vend; ++vi) {
+            float3 r = float3::zero();
+            if (angle_weighted) {
+                connection.eachConnectedFaces(vi, [&](int fi, int ii) {
+                    r += face_normals[fi] * corner_weights[ii];
+                });
+            }
+            else {
+                connection.eachConnectedFaces(vi, [&](int fi, int) {
+                    r += face_normals[fi];
+                });
+            }
+            dst[vi] = normalize(r);
+        }
+    });
 }
 
 template<class Indices, class Counts, class Offsets>
@@ -293,13 +351,19 @@ private:
 template<class Handler>
 inline void SelectEdge(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler)
+{
+    ConnectionData connection;
+    connection.buildConnection(indices, ngon, vertices);
+    SelectEdge(indices, ngon, vertices, connection, vertex_indices, handler);
+}
+
+template<class Handler>
+inline void SelectEdge(const IArray<int>& indices, int ngon, const IArray<float3>& vertices, const ConnectionData& connection,
+    const IArray<int>& vertex_indices, const Handler& handler)
 {
     impl::CountsC counts{ ngon, indices.size() / ngon };
     impl::OffsetsC offsets{ ngon, indices.size() / ngon };
 
-    ConnectionData connection;
-    impl::BuildConnection(connection, indices, counts, vertices);
-
     impl::SelectEdgeImpl<decltype(indices), decltype(counts), decltype(offsets)>
         impl(indices, counts, offsets, vertices, connection);
 
@@ -325,18 +389,22 @@ inline void SelectEdge(const IArray<int>& indices, const IArray<int>& counts, co
 
 
 template<class Handler>
-inline void SelectHole(const IArray<int>& indices_, int ngon, const IArray<float3>& vertices,
+inline void SelectHole(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
+    const IArray<int>& vertex_indices, const Handler& handler)
+{
+    ConnectionData connection;
+    connection.buildConnection(indices, ngon, vertices, true);
+    SelectHole(indices, ngon, vertices, connection, vertex_indices, handler);
+}
+
+template<class Handler>
+inline void SelectHole(const IArray<int>& indices_, int ngon, const IArray<float3>& vertices, const ConnectionData& connection,
     const IArray<int>& vertex_indices, const Handler& handler)
 {
     impl::CountsC counts{ ngon, indices_.size() / ngon };
     impl::OffsetsC offsets{ ngon, indices_.size() / ngon };
 
-    ConnectionData connection;
-    impl::BuildWeldMap(connection, vertices);
-
     impl::IndicesW indices{ indices_, connection.weld_map };
-    impl::BuildConnection(connection, indices, counts, vertices);
-
     impl::SelectEdgeImpl<decltype(indices), decltype(counts), decltype(offsets)>
         impl(indices, counts, offsets, vertices, connection);
 
@@ -350,7 +418,7 @@ inline void SelectHole(const IArray<int>& indices_, const IArray<int>& counts, c
     const IArray<int>& vertex_indices, const Handler& handler)
 {
     ConnectionData connection;
-    impl::BuildWeldMap(connection, vertices);
+    connection.buildWeldMap(vertices);
 
     impl::IndicesW indices{ indices_, connection.weld_map };
     impl::BuildConnection(connection, indices, counts, vertices);
@@ -367,13 +435,19 @@ inline void SelectHole(const IArray<int>& indices_, const IArray<int>& counts, c
 template<class Handler>
 inline void SelectConnected(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler)
+{
+    ConnectionData connection;
+    connection.buildConnection(indices, ngon, vertices);
+    SelectConnected(indices, ngon, vertices, connection, vertex_indices, handler);
+}
+
+template<class Handler>
+inline void SelectConnected(const IArray<int>& indices, int ngon, const IArray<float3>& vertices, const ConnectionData& connection,
+    const IArray<int>& vertex_indices, const Handler& handler)
 {
     impl::CountsC counts{ ngon, indices.size() / ngon };
     impl::OffsetsC offsets{ ngon, indices.size() / ngon };
 
-    ConnectionData connection;
-    impl::BuildConnection(connection, indices, counts, vertices);
-
     impl::SelectEdgeImpl<decltype(indices), decltype(counts), decltype(offsets)>
         impl(indices, counts, offsets, vertices, connection);
 
@@ -416,7 +490,7 @@ void GenerateNormalsPoly(float3 *dst,
         }
 
         const int *face = &indices[offsets[fi]];
-        int num_triangles = (fi - 2) * 3;
+        int num_triangles = count - 2;
         for (int ti = 0; ti < num_triangles; ++ti) {
             int tidx[3] = { 0, ti + 1, ti + 2 };
             float3 p0 = face_vertices[tidx[0]];
@@ -456,7 +530,7 @@ void GenerateTangentsPoly(float4 *dst,
         }
 
         const int *face = &indices[offsets[fi]];
-        int num_triangles = (fi - 2) * 3;
+        int num_triangles = count - 2;
         for (int ti = 0; ti < num_triangles; ++ti) {
             int tidx[3] = { 0, ti + 1, ti + 2 };
             float3 v[3] = { face_vertices[tidx[0]], face_vertices[tidx[1]], face_vertices[tidx[2]] };
@@ -466,8 +540,8 @@ void GenerateTangentsPoly(float4 *dst,
             compute_triangle_tangent(v, u, t, b);
 
             for (int i = 0; i < 3; ++i) {
-                tangents[face[tidx[i]]] += t[tidx[i]];
-                binormals[face[tidx[i]]] += b[tidx[i]];
+                tangents[face[tidx[i]]] += t[i];
+                binormals[face[tidx[i]]] += b[i];
             }
         }
     }
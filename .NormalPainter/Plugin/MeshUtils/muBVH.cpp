@@ -0,0 +1,430 @@
+#include "pch.h"
+#include <atomic>
+#include "MeshUtils.h"
+
+namespace mu {
+
+static const int BVHNumBins = 16;
+static const int BVHMaxLeafSize = 8;
+static const int BVHMaxDepth = 48;
+static const int BVHParallelThreshold = 4096;
+static const int BVHParallelRefitDepth = 6;
+
+struct TriangleBVH::BuildContext
+{
+    RawVector<float3> tri_min, tri_max, centers;
+    std::atomic_int num_nodes{ 0 };
+};
+
+static inline float SurfaceArea(const float3& bmin, const float3& bmax)
+{
+    float3 e = bmax - bmin;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// ray_triangle_intersection() accepts hits slightly outside of the triangle. pad bounds to not miss them.
+static inline void TriangleBounds(const float3& p0, const float3& p1, const float3& p2, float3& dst_min, float3& dst_max)
+{
+    float3 bmin = min(min(p0, p1), p2);
+    float3 bmax = max(max(p0, p1), p2);
+    float3 e = bmax - bmin;
+    float pad = std::max<float>(std::max<float>(e.x, e.y), e.z) * 1e-3f + 1e-6f;
+    dst_min = bmin - pad;
+    dst_max = bmax + pad;
+}
+
+static inline float SafeRcp(float v)
+{
+    return std::abs(v) > 1e-20f ? 1.0f / v : (v >= 0.0f ? 1e20f : -1e20f);
+}
+
+// returns entry distance if the ray hits the box within [0, tmax], otherwise FLT_MAX
+static inline float RayBoxDistance(const TriangleBVH::Node& node, const float3& pos, const float3& idir, float tmax)
+{
+    float3 t1 = (node.bb_min - pos) * idir;
+    float3 t2 = (node.bb_max - pos) * idir;
+    float3 tn = min(t1, t2);
+    float3 tf = max(t1, t2);
+    float tnear = std::max<float>(std::max<float>(tn.x, tn.y), std::max<float>(tn.z, 0.0f));
+    float tfar = std::min<float>(std::min<float>(tf.x, tf.y), std::min<float>(tf.z, tmax));
+    return tnear <= tfar ? tnear : FLT_MAX;
+}
+
+// RayBoxDistance() for the four children of a wide node. fixed trip count and no branches so that
+// compilers can turn the loop into 4-wide SIMD.
+static inline void RayBoxDistance4(const TriangleBVH::WideNode& node, const float3& pos, const float3& idir, float tmax,
+    float (&dst)[4])
+{
+    for (int l = 0; l < 4; ++l) {
+        float tx1 = (node.bb_min_x[l] - pos.x) * idir.x, tx2 = (node.bb_max_x[l] - pos.x) * idir.x;
+        float ty1 = (node.bb_min_y[l] - pos.y) * idir.y, ty2 = (node.bb_max_y[l] - pos.y) * idir.y;
+        float tz1 = (node.bb_min_z[l] - pos.z) * idir.z, tz2 = (node.bb_max_z[l] - pos.z) * idir.z;
+        float tnear = std::max<float>(std::max<float>(std::min<float>(tx1, tx2), std::min<float>(ty1, ty2)),
+            std::max<float>(std::min<float>(tz1, tz2), 0.0f));
+        float tfar = std::min<float>(std::min<float>(std::max<float>(tx1, tx2), std::max<float>(ty1, ty2)),
+            std::min<float>(std::max<float>(tz1, tz2), tmax));
+        dst[l] = tnear <= tfar ? tnear : FLT_MAX;
+    }
+}
+
+
+void TriangleBVH::clear()
+{
+    nodes.clear();
+    wide_nodes.clear();
+    wide_slots.clear();
+    triangles.clear();
+    vertices = nullptr;
+    indices = nullptr;
+    num_triangles = 0;
+    build_cost = 0.0f;
+}
+
+void TriangleBVH::build(const float3 *vertices_, const int *indices_, int num_triangles_)
+{
+    clear();
+    if (!vertices_ || !indices_ || num_triangles_ <= 0) { return; }
+
+    vertices = vertices_;
+    indices = indices_;
+    num_triangles = num_triangles_;
+
+    BuildContext ctx;
+    ctx.tri_min.resize_discard(num_triangles);
+    ctx.tri_max.resize_discard(num_triangles);
+    ctx.centers.resize_discard(num_triangles);
+    triangles.resize_discard(num_triangles);
+    parallel_for_blocked(0, num_triangles, 1024, [&](int ti, int tend) {
+        for (; ti < tend; ++ti) {
+            TriangleBounds(
+                vertices[indices[ti * 3 + 0]], vertices[indices[ti * 3 + 1]], vertices[indices[ti * 3 + 2]],
+                ctx.tri_min[ti], ctx.tri_max[ti]);
+            ctx.centers[ti] = (ctx.tri_min[ti] + ctx.tri_max[ti]) * 0.5f;
+            triangles[ti] = ti;
+        }
+    });
+
+    nodes.resize_discard(num_triangles * 2 - 1);
+    ctx.num_nodes = 1;
+    buildNode(ctx, 0, 0, num_triangles, 0);
+    nodes.resize(ctx.num_nodes);
+    nodes.shrink_to_fit();
+    build_cost = getCost();
+
+    wide_nodes.reserve(nodes.size() / 3 + 1);
+    wide_slots.resize_discard(nodes.size());
+    for (auto& slot : wide_slots) { slot = -1; }
+    collapseNode(0);
+    wide_nodes.shrink_to_fit();
+}
+
+void TriangleBVH::buildNode(BuildContext& ctx, int ni, int begin, int end, int depth)
+{
+    const int n = end - begin;
+    float3 bmin = { FLT_MAX, FLT_MAX, FLT_MAX }, bmax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float3 cmin = bmin, cmax = bmax;
+    for (int i = begin; i < end; ++i) {
+        int ti = triangles[i];
+        bmin = min(bmin, ctx.tri_min[ti]);
+        bmax = max(bmax, ctx.tri_max[ti]);
+        cmin = min(cmin, ctx.centers[ti]);
+        cmax = max(cmax, ctx.centers[ti]);
+    }
+
+    auto& node = nodes[ni];
+    node.bb_min = bmin;
+    node.bb_max = bmax;
+    node.first = begin;
+    node.count = n;
+    if (n <= 2) { return; }
+
+    // find best split by binned SAH
+    int best_axis = -1, best_bin = 0;
+    float best_cost = FLT_MAX;
+    float3 cext = cmax - cmin;
+    if (depth < BVHMaxDepth) {
+        for (int axis = 0; axis < 3; ++axis) {
+            if (cext[axis] <= 0.0f) { continue; }
+
+            int counts[BVHNumBins] = {};
+            float3 bin_min[BVHNumBins], bin_max[BVHNumBins];
+            for (int b = 0; b < BVHNumBins; ++b) {
+                bin_min[b] = { FLT_MAX, FLT_MAX, FLT_MAX };
+                bin_max[b] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            }
+
+            float scale = (float)BVHNumBins / cext[axis];
+            for (int i = begin; i < end; ++i) {
+                int ti = triangles[i];
+                int b = std::min<int>((int)((ctx.centers[ti][axis] - cmin[axis]) * scale), BVHNumBins - 1);
+                ++counts[b];
+                bin_min[b] = min(bin_min[b], ctx.tri_min[ti]);
+                bin_max[b] = max(bin_max[b], ctx.tri_max[ti]);
+            }
+
+            // sweep from right to accumulate right side costs
+            float right_cost[BVHNumBins];
+            {
+                float3 rmin = { FLT_MAX, FLT_MAX, FLT_MAX }, rmax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+                int rcount = 0;
+                for (int b = BVHNumBins - 1; b > 0; --b) {
+                    rcount += counts[b];
+                    rmin = min(rmin, bin_min[b]);
+                    rmax = max(rmax, bin_max[b]);
+                    right_cost[b] = rcount > 0 ? SurfaceArea(rmin, rmax) * rcount : 0.0f;
+                }
+            }
+
+            float3 lmin = { FLT_MAX, FLT_MAX, FLT_MAX }, lmax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            int lcount = 0;
+            for (int b = 0; b < BVHNumBins - 1; ++b) {
+                lcount += counts[b];
+                lmin = min(lmin, bin_min[b]);
+                lmax = max(lmax, bin_max[b]);
+                if (lcount == 0 || lcount == n) { continue; }
+
+                float cost = SurfaceArea(lmin, lmax) * lcount + right_cost[b + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+    }
+
+    int mid;
+    if (best_axis != -1) {
+        // splitting is not worth it if the cost is higher than testing all triangles
+        if (n <= BVHMaxLeafSize && best_cost >= SurfaceArea(bmin, bmax) * n) { return; }
+
+        float scale = (float)BVHNumBins / cext[best_axis];
+        float base = cmin[best_axis];
+        auto *pivot = std::partition(triangles.data() + begin, triangles.data() + end, [&](int ti) {
+            int b = std::min<int>((int)((ctx.centers[ti][best_axis] - base) * scale), BVHNumBins - 1);
+            return b <= best_bin;
+        });
+        mid = (int)(pivot - triangles.data());
+    }
+    else {
+        // all centers are identical or the tree is too deep. split by count.
+        if (n <= BVHMaxLeafSize) { return; }
+        mid = begin + n / 2;
+    }
+
+    int ci = ctx.num_nodes.fetch_add(2);
+    node.first = ci;
+    node.count = 0;
+
+    auto build_left = [&]() { buildNode(ctx, ci + 0, begin, mid, depth + 1); };
+    auto build_right = [&]() { buildNode(ctx, ci + 1, mid, end, depth + 1); };
+    if (n >= BVHParallelThreshold) {
+        parallel_invoke(build_left, build_right);
+    }
+    else {
+        build_left();
+        build_right();
+    }
+}
+
+float TriangleBVH::refit()
+{
+    if (nodes.empty()) { return 0.0f; }
+    refitNode(0, 0);
+    return build_cost > 0.0f ? getCost() / build_cost : 1.0f;
+}
+
+void TriangleBVH::refitNode(int ni, int depth)
+{
+    auto& node = nodes[ni];
+    if (node.count > 0) {
+        float3 bmin = { FLT_MAX, FLT_MAX, FLT_MAX }, bmax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (int i = 0; i < node.count; ++i) {
+            int ti = triangles[node.first + i];
+            float3 tmin, tmax;
+            TriangleBounds(
+                vertices[indices[ti * 3 + 0]], vertices[indices[ti * 3 + 1]], vertices[indices[ti * 3 + 2]],
+                tmin, tmax);
+            bmin = min(bmin, tmin);
+            bmax = max(bmax, tmax);
+        }
+        node.bb_min = bmin;
+        node.bb_max = bmax;
+        setWideBounds(ni);
+        return;
+    }
+
+    // children first (bottom-up). upper levels fork into tasks.
+    int l = node.first, r = node.first + 1;
+    if (depth < BVHParallelRefitDepth) {
+        parallel_invoke(
+            [&]() { refitNode(l, depth + 1); },
+            [&]() { refitNode(r, depth + 1); });
+    }
+    else {
+        refitNode(l, depth + 1);
+        refitNode(r, depth + 1);
+    }
+    node.bb_min = min(nodes[l].bb_min, nodes[r].bb_min);
+    node.bb_max = max(nodes[l].bb_max, nodes[r].bb_max);
+    setWideBounds(ni);
+}
+
+// makes a wide node from binary node ni and its descendants. returns its index in wide_nodes.
+// inner children with the largest surface area are replaced by their children until there are four.
+int TriangleBVH::collapseNode(int ni)
+{
+    int children[4];
+    int num_children = 0;
+    if (nodes[ni].count > 0) {
+        // the root is a leaf
+        children[num_children++] = ni;
+    }
+    else {
+        children[num_children++] = nodes[ni].first;
+        children[num_children++] = nodes[ni].first + 1;
+        while (num_children < 4) {
+            int best = -1;
+            float best_area = -1.0f;
+            for (int ci = 0; ci < num_children; ++ci) {
+                const auto& child = nodes[children[ci]];
+                if (child.count > 0) { continue; }
+                float area = SurfaceArea(child.bb_min, child.bb_max);
+                if (area > best_area) {
+                    best_area = area;
+                    best = ci;
+                }
+            }
+            if (best == -1) { break; }
+
+            int first = nodes[children[best]].first;
+            children[best] = first;
+            children[num_children++] = first + 1;
+        }
+    }
+
+    int wi = (int)wide_nodes.size();
+    wide_nodes.push_back({});
+    for (int ci = 0; ci < 4; ++ci) {
+        // unused children: zero sized box at the origin. count < 0 keeps them from being visited.
+        int first = 0, count = -1;
+        if (ci < num_children) {
+            int cni = children[ci];
+            wide_slots[cni] = wi * 4 + ci;
+            setWideBounds(cni);
+            if (nodes[cni].count > 0) {
+                first = nodes[cni].first;
+                count = nodes[cni].count;
+            }
+            else {
+                first = collapseNode(cni);
+                count = 0;
+            }
+        }
+        else {
+            auto& wnode = wide_nodes[wi];
+            wnode.bb_min_x[ci] = wnode.bb_min_y[ci] = wnode.bb_min_z[ci] = 0.0f;
+            wnode.bb_max_x[ci] = wnode.bb_max_y[ci] = wnode.bb_max_z[ci] = 0.0f;
+        }
+        auto& wnode = wide_nodes[wi]; // collapseNode() may reallocate wide_nodes
+        wnode.first[ci] = first;
+        wnode.count[ci] = count;
+    }
+    return wi;
+}
+
+// copies bounds of node ni to the wide node that has it as a child
+void TriangleBVH::setWideBounds(int ni)
+{
+    int slot = wide_slots[ni];
+    if (slot == -1) { return; }
+
+    const auto& node = nodes[ni];
+    auto& wnode = wide_nodes[slot / 4];
+    int ci = slot % 4;
+    wnode.bb_min_x[ci] = node.bb_min.x; wnode.bb_min_y[ci] = node.bb_min.y; wnode.bb_min_z[ci] = node.bb_min.z;
+    wnode.bb_max_x[ci] = node.bb_max.x; wnode.bb_max_y[ci] = node.bb_max.y; wnode.bb_max_z[ci] = node.bb_max.z;
+}
+
+float TriangleBVH::getCost() const
+{
+    if (nodes.empty()) { return 0.0f; }
+
+    // inner nodes cost a box test, leaves cost a test per triangle
+    float cost = 0.0f;
+    for (const auto& node : nodes) {
+        cost += SurfaceArea(node.bb_min, node.bb_max) * (node.count > 0 ? node.count : 1);
+    }
+    float root_area = SurfaceArea(nodes[0].bb_min, nodes[0].bb_max);
+    return root_area > 0.0f ? cost / root_area : 0.0f;
+}
+
+int TriangleBVH::raycast(float3 pos, float3 dir, int& tindex, float& distance) const
+{
+    distance = FLT_MAX;
+    if (wide_nodes.empty()) { return 0; }
+
+    const float3 idir = { SafeRcp(dir.x), SafeRcp(dir.y), SafeRcp(dir.z) };
+    int hit_ti = -1;
+    float hit_d = FLT_MAX;
+
+    // first / count are the same as WideNode's children
+    struct StackItem { int first, count; float tnear; };
+    StackItem stack[(BVHMaxDepth + 64) * 3];
+    int sp = 0;
+
+    float t = RayBoxDistance(nodes[0], pos, idir, hit_d);
+    if (t == FLT_MAX) { return 0; }
+    stack[sp++] = { 0, 0, t };
+
+    while (sp > 0) {
+        auto item = stack[--sp];
+        // ties must be visited to pick the smallest triangle index like brute force does
+        if (item.tnear > hit_d) { continue; }
+
+        if (item.count > 0) {
+            for (int i = 0; i < item.count; ++i) {
+                int ti = triangles[item.first + i];
+                float d;
+                if (ray_triangle_intersection(pos, dir,
+                    vertices[indices[ti * 3 + 0]], vertices[indices[ti * 3 + 1]], vertices[indices[ti * 3 + 2]], d))
+                {
+                    if (d < hit_d || (d == hit_d && ti < hit_ti)) {
+                        hit_d = d;
+                        hit_ti = ti;
+                    }
+                }
+            }
+        }
+        else {
+            const auto& wnode = wide_nodes[item.first];
+            float td[4];
+            RayBoxDistance4(wnode, pos, idir, hit_d, td);
+
+            // push hit children far to near so that the nearest one is visited first
+            int num_hits = 0;
+            StackItem hits[4];
+            for (int ci = 0; ci < 4; ++ci) {
+                if (wnode.count[ci] < 0 || td[ci] == FLT_MAX) { continue; }
+                StackItem h = { wnode.first[ci], wnode.count[ci], td[ci] };
+                int i = num_hits++;
+                for (; i > 0 && hits[i - 1].tnear < h.tnear; --i) {
+                    hits[i] = hits[i - 1];
+                }
+                hits[i] = h;
+            }
+            for (int i = 0; i < num_hits; ++i) {
+                stack[sp++] = hits[i];
+            }
+        }
+    }
+
+    if (hit_ti != -1) {
+        tindex = hit_ti;
+        distance = hit_d;
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace mu
@@ -0,0 +1,60 @@
+#pragma once
+
+namespace mu {
+
+// bounding volume hierarchy over indexed triangles (binned SAH).
+// vertices and indices are referenced, not copied. they must outlive the BVH and
+// build() must be called again if triangles are added or removed.
+struct TriangleBVH
+{
+    struct Node
+    {
+        float3 bb_min;
+        int first; // leaf: offset in triangles. inner: index of the left child (right child is first + 1)
+        float3 bb_max;
+        int count; // leaf: number of triangles. inner: 0
+    };
+
+    // 4-wide node collapsed from the binary tree for raycast(). child boxes are in SoA layout so that
+    // all four can be tested at once. first / count of each child: count > 0: leaf (same as Node),
+    // count == 0: inner (first is index in wide_nodes), count < 0: unused.
+    struct WideNode
+    {
+        float bb_min_x[4], bb_min_y[4], bb_min_z[4];
+        float bb_max_x[4], bb_max_y[4], bb_max_z[4];
+        int first[4];
+        int count[4];
+    };
+
+    RawVector<Node> nodes;
+    RawVector<WideNode> wide_nodes;
+    RawVector<int>  wide_slots; // wide node index * 4 + child of each node. -1 if it is not a child of a wide node
+    RawVector<int>  triangles; // triangle indices sorted by leaf
+    const float3    *vertices = nullptr;
+    const int       *indices = nullptr;
+    int             num_triangles = 0;
+    float           build_cost = 0.0f; // getCost() right after build()
+
+    void clear();
+    void build(const float3 *vertices, const int *indices, int num_triangles);
+    bool empty() const { return nodes.empty(); }
+
+    // updates bounds of nodes for moved vertices (e.g. skinning) keeping the tree structure.
+    // much cheaper than build(), but the tree gets worse as vertices move away from where it was built.
+    // returns getCost() / build_cost. rebuilding is recommended if it is large (e.g. 2.0).
+    float refit();
+    // SAH cost relative to the root's surface area
+    float getCost() const;
+
+    // same result as RayTrianglesIntersectionIndexed() except return value is 0 or 1, not number of hits.
+    int raycast(float3 pos, float3 dir, int& tindex, float& distance) const;
+
+private:
+    struct BuildContext;
+    void buildNode(BuildContext& ctx, int ni, int begin, int end, int depth);
+    void refitNode(int ni, int depth);
+    int collapseNode(int ni);
+    void setWideBounds(int ni);
+};
+
+} // namespace mu
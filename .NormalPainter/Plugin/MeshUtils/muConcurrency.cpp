@@ -0,0 +1,207 @@
+#include "pch.h"
+#include "MeshUtils.h"
+
+#ifdef muEnableThreadPool
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+namespace mu {
+namespace impl {
+
+// shared by the tasks of a run() call. the last finishing task wakes up the caller.
+struct Completion
+{
+    std::atomic_int pending;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+};
+
+struct Task
+{
+    const std::function<void(int)> *body;
+    int index;
+    Completion *completion;
+};
+
+// each worker has its own queue. a thread pushes and pops its tasks at the back,
+// idle threads steal from the front of others' queues.
+// threads that are not workers (e.g. the main thread) share the last queue.
+class ThreadPool
+{
+public:
+    static ThreadPool& getInstance();
+    ThreadPool();
+    ~ThreadPool();
+    int getNumThreads() const { return (int)m_workers.size() + 1; }
+    void run(int num_tasks, const std::function<void(int)>& body);
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerMain(int qi);
+    bool findTask(int qi, Task& dst);
+    void execute(const Task& task);
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::atomic_int m_num_queued{ 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+};
+
+static thread_local int g_queue_index = -1;
+
+// number of times run() yields without finding a task before it sleeps until its tasks are done
+static const int MaxSpinCount = 64;
+
+ThreadPool& ThreadPool::getInstance()
+{
+    static ThreadPool s_instance;
+    return s_instance;
+}
+
+ThreadPool::ThreadPool()
+{
+    int num_workers = std::max<int>((int)std::thread::hardware_concurrency(), 1) - 1;
+    for (int i = 0; i < num_workers + 1; ++i) {
+        m_queues.emplace_back(new Queue());
+    }
+    for (int i = 0; i < num_workers; ++i) {
+        m_workers.emplace_back([this, i]() { workerMain(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& w : m_workers) {
+        w.join();
+    }
+}
+
+void ThreadPool::run(int num_tasks, const std::function<void(int)>& body)
+{
+    if (num_tasks <= 0) { return; }
+    if (num_tasks == 1 || m_workers.empty()) {
+        for (int i = 0; i < num_tasks; ++i) { body(i); }
+        return;
+    }
+
+    int qi = g_queue_index >= 0 ? g_queue_index : (int)m_queues.size() - 1;
+    Completion completion;
+    completion.pending = num_tasks;
+    {
+        // reversed so that this thread pops them in order and thieves take the last ones
+        auto& q = *m_queues[qi];
+        std::unique_lock<std::mutex> lock(q.mutex);
+        for (int i = num_tasks - 1; i > 0; --i) {
+            q.tasks.push_back({ &body, i, &completion });
+        }
+    }
+    m_num_queued += num_tasks - 1;
+    {
+        // sync with workers going to sleep so that the notification is not lost
+        std::unique_lock<std::mutex> lock(m_mutex);
+    }
+    m_cond.notify_all();
+
+    execute({ &body, 0, &completion });
+    int num_spins = 0;
+    while (completion.pending > 0 && num_spins < MaxSpinCount) {
+        // help others while waiting. tasks of this call are found first as they are at the back of the own queue.
+        Task task;
+        if (findTask(qi, task)) {
+            execute(task);
+            num_spins = 0;
+        }
+        else {
+            ++num_spins;
+            std::this_thread::yield();
+        }
+    }
+
+    // nothing left to steal. sleep until the slowest task is done instead of holding the core.
+    // always done under the mutex so that completion is not destroyed while the last task is signaling it.
+    std::unique_lock<std::mutex> lock(completion.mutex);
+    completion.cond.wait(lock, [&]() { return completion.done; });
+}
+
+void ThreadPool::workerMain(int qi)
+{
+    g_queue_index = qi;
+    for (;;) {
+        Task task;
+        if (findTask(qi, task)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return m_stop || m_num_queued > 0; });
+        if (m_stop) { return; }
+    }
+}
+
+bool ThreadPool::findTask(int qi, Task& dst)
+{
+    if (m_num_queued == 0) { return false; }
+
+    int num_queues = (int)m_queues.size();
+    for (int i = 0; i < num_queues; ++i) {
+        auto& q = *m_queues[(qi + i) % num_queues];
+        std::unique_lock<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) { continue; }
+        if (i == 0) {
+            dst = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        else {
+            dst = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        --m_num_queued;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::execute(const Task& task)
+{
+    (*task.body)(task.index);
+    // the caller of run() returns only after done is set under the mutex, so completion stays alive until then.
+    auto& completion = *task.completion;
+    if (--completion.pending == 0) {
+        std::unique_lock<std::mutex> lock(completion.mutex);
+        completion.done = true;
+        completion.cond.notify_one();
+    }
+}
+
+
+void RunTasks(int num_tasks, const std::function<void(int)>& body)
+{
+    ThreadPool::getInstance().run(num_tasks, body);
+}
+
+int GetNumThreads()
+{
+    return ThreadPool::getInstance().getNumThreads();
+}
+
+} // namespace impl
+} // namespace mu
+
+#endif // muEnableThreadPool
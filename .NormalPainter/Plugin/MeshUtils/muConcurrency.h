@@ -1,14 +1,31 @@
 #pragma once
 
+#include <vector>
 #include "muConfig.h"
 #if defined(muEnablePPL)
     #include <ppl.h>
 #elif defined(muEnableTBB)
     #include <tbb/tbb.h>
+#elif !defined(muDisableThreadPool)
+    #define muEnableThreadPool
+    #include <functional>
 #endif
 
 namespace mu {
 
+#ifdef muEnableThreadPool
+namespace impl {
+
+// built-in work-stealing thread pool (muConcurrency.cpp). used if neither PPL nor TBB is available.
+// calls body(i) for each i in [0, num_tasks) and returns when all of them are done.
+// the calling thread runs tasks while waiting, so this can be called from tasks.
+void RunTasks(int num_tasks, const std::function<void(int)>& body);
+// worker threads + calling thread
+int GetNumThreads();
+
+} // namespace impl
+#endif
+
 template<class Index, class Body>
 inline void parallel_for(Index begin, Index end, const Body& body)
 {
@@ -16,12 +33,22 @@ inline void parallel_for(Index begin, Index end, const Body& body)
     concurrency::parallel_for(begin, end, body);
 #elif defined(muEnableTBB)
     tbb::parallel_for(begin, end, body);
+#elif defined(muEnableThreadPool)
+    // split into some tasks per thread. idle threads steal remaining ones.
+    auto num_elements = (int64_t)(end - begin);
+    if (num_elements <= 0) { return; }
+    int num_tasks = (int)std::min<int64_t>(num_elements, impl::GetNumThreads() * 8);
+    impl::RunTasks(num_tasks, [&](int ti) {
+        Index b = begin + (Index)(num_elements * ti / num_tasks);
+        Index e = begin + (Index)(num_elements * (ti + 1) / num_tasks);
+        for (; b != e; ++b) { body(b); }
+    });
 #else
     for (; begin != end; ++begin) { body(begin); }
 #endif
 }
 
-#if defined(muEnablePPL) || defined(muEnableTBB)
+#if defined(muEnablePPL) || defined(muEnableTBB) || defined(muEnableThreadPool)
 template<class Body>
 inline void parallel_for_blocked(int begin, int end, int granularity, const Body& body)
 {
@@ -48,6 +75,9 @@ inline void parallel_for_each(Iter begin, Iter end, const Body& body)
     concurrency::parallel_for_each(begin, end, body);
 #elif defined(muEnableTBB)
     tbb::parallel_for_each(begin, end, body);
+#elif defined(muEnableThreadPool)
+    // Iter must be a random access iterator
+    parallel_for(0, (int)std::distance(begin, end), [&](int i) { body(*(begin + i)); });
 #else
     for (; begin != end; ++begin) { body(*begin); }
 #endif
@@ -64,6 +94,15 @@ inline void parallel_invoke(Bodies... bodies) { concurrency::parallel_invoke(bod
 template <class... Bodies>
 inline void parallel_invoke(Bodies... bodies) { tbb::parallel_invoke(bodies...); }
 
+#elif defined(muEnableThreadPool)
+
+template <class... Bodies>
+inline void parallel_invoke(const Bodies&... bodies)
+{
+    std::function<void()> tasks[] = { bodies... };
+    impl::RunTasks((int)sizeof...(bodies), [&](int i) { tasks[i](); });
+}
+
 #else
 
 template <class Body>
@@ -77,5 +116,106 @@ void parallel_invoke(const Body& first, Args... args) {
 
 #endif
 
+
+// the following are built on parallel_for() and available on all backends.
+// the input range is split into blocks of granularity and partial results are combined in block order,
+// so results are deterministic regardless of the number of threads.
+
+// Body: [](int begin, int end) -> T (result of [begin, end))
+// Join: [](const T& a, const T& b) -> T
+template<class T, class Body, class Join>
+inline T parallel_reduce(int begin, int end, int granularity, const T& identity, const Body& body, const Join& join)
+{
+    int num_elements = end - begin;
+    if (num_elements <= 0) { return identity; }
+
+    int num_blocks = ceildiv(num_elements, granularity);
+    std::vector<T> partials(num_blocks, identity);
+    parallel_for(0, num_blocks, [&](int bi) {
+        int b = begin + granularity * bi;
+        int e = std::min<int>(b + granularity, end);
+        partials[bi] = body(b, e);
+    });
+
+    T ret = identity;
+    for (const auto& p : partials) { ret = join(ret, p); }
+    return ret;
+}
+
+// exclusive prefix sum: dst[i] = src[0] + ... + src[i - 1]. returns the sum of all elements.
+// dst can be the same as src.
+template<class T>
+inline T parallel_scan(const T *src, T *dst, int num, int granularity)
+{
+    if (num <= 0) { return T(); }
+
+    int num_blocks = ceildiv(num, granularity);
+    std::vector<T> offsets(num_blocks);
+    parallel_for(0, num_blocks, [&](int bi) {
+        int b = granularity * bi;
+        int e = std::min<int>(b + granularity, num);
+        T sum = T();
+        for (int i = b; i < e; ++i) { sum += src[i]; }
+        offsets[bi] = sum;
+    });
+
+    T total = T();
+    for (auto& o : offsets) {
+        T sum = o;
+        o = total;
+        total += sum;
+    }
+
+    parallel_for(0, num_blocks, [&](int bi) {
+        int b = granularity * bi;
+        int e = std::min<int>(b + granularity, num);
+        T sum = offsets[bi];
+        for (int i = b; i < e; ++i) {
+            T v = src[i];
+            dst[i] = sum;
+            sum += v;
+        }
+    });
+    return total;
+}
+
+// stores indices in [begin, end) that satisfy pred into dst in ascending order and returns the number of them.
+// Indices: container of int with resize() and data() (RawVector<int>, std::vector<int>)
+// Pred: [](int i) -> bool. called twice for each index (to count and to store), so it must be cheap and stable.
+template<class Indices, class Pred>
+inline int parallel_compact(int begin, int end, int granularity, Indices& dst, const Pred& pred)
+{
+    int num_elements = end - begin;
+    if (num_elements <= 0) {
+        dst.resize(0);
+        return 0;
+    }
+
+    int num_blocks = ceildiv(num_elements, granularity);
+    std::vector<int> offsets(num_blocks);
+    parallel_for(0, num_blocks, [&](int bi) {
+        int b = begin + granularity * bi;
+        int e = std::min<int>(b + granularity, end);
+        int c = 0;
+        for (int i = b; i < e; ++i) {
+            if (pred(i)) { ++c; }
+        }
+        offsets[bi] = c;
+    });
+    int total = parallel_scan(offsets.data(), offsets.data(), num_blocks, 1024);
+
+    dst.resize(total);
+    auto *d = dst.data();
+    parallel_for(0, num_blocks, [&](int bi) {
+        int b = begin + granularity * bi;
+        int e = std::min<int>(b + granularity, end);
+        int o = offsets[bi];
+        for (int i = b; i < e; ++i) {
+            if (pred(i)) { d[o++] = i; }
+        }
+    });
+    return total;
+}
+
 } // namespace ms
 
@@ -3,6 +3,7 @@
 // available options:
 //   muEnablePPL
 //   muEnableTBB
+//   muDisableThreadPool (built-in thread pool is used if neither PPL nor TBB is enabled)
 //   muEnableISPC
 //   muEnableAMP
 //   muEnableSymbol
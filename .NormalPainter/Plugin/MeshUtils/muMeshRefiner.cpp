@@ -56,25 +56,10 @@ void MeshRefiner::prepare(
 
 void MeshRefiner::genNormals(bool flip)
 {
-    auto& p = points;
-    normals_tmp.resize_zeroclear(p.size());
+    buildConnection();
 
-    size_t num_faces = counts.size();
-    int i1 = flip ? 2 : 1;
-    int i2 = flip ? 1 : 2;
-    for (size_t fi = 0; fi < num_faces; ++fi)
-    {
-        int count = counts[fi];
-        const int *face = &indices[offsets[fi]];
-        float3 p0 = p[face[0]];
-        float3 p1 = p[face[i1]];
-        float3 p2 = p[face[i2]];
-        float3 n = cross(p1 - p0, p2 - p0);
-        for (int ci = 0; ci < count; ++ci) {
-            normals_tmp[face[ci]] += n;
-        }
-    }
-    Normalize(normals_tmp.data(), normals_tmp.size());
+    normals_tmp.resize_discard(points.size());
+    GenerateNormalsWithConnection(normals_tmp, points, indices, counts, offsets, connection, NormalWeighting::Area, flip);
 
     normals = normals_tmp;
 }
@@ -0,0 +1,88 @@
+#include "pch.h"
+#include "MeshUtils.h"
+
+namespace mu {
+
+static const int PointGridPointsPerCell = 8;
+static const int PointGridMaxCells = 1 << 20; // per axis
+
+void PointGrid::clear()
+{
+    points = nullptr;
+    num_points = 0;
+    cell_size = rcp_cell_size = 0.0f;
+    bb_min = bb_max = float3::zero();
+    cell_max[0] = cell_max[1] = cell_max[2] = 0;
+    bucket_mask = 0;
+    bucket_offsets.clear();
+    entries.clear();
+}
+
+void PointGrid::build(const float3 *points_, int num_points_, float cell_size_)
+{
+    clear();
+    if (!points_ || num_points_ <= 0) { return; }
+
+    points = points_;
+    num_points = num_points_;
+    MinMax(points, num_points, bb_min, bb_max);
+
+    float3 ext = bb_max - bb_min;
+    float max_ext = std::max<float>(std::max<float>(ext.x, ext.y), ext.z);
+    if (cell_size_ <= 0.0f) {
+        // assume points are on surfaces (meshes): about half of the bounding box's surface area.
+        float area = (ext.x * ext.y + ext.y * ext.z + ext.z * ext.x);
+        cell_size_ = std::sqrt(area * PointGridPointsPerCell / num_points);
+    }
+    cell_size_ = std::max<float>(cell_size_, max_ext / PointGridMaxCells);
+    if (!(cell_size_ > 0.0f)) {
+        // all points are at the same position
+        cell_size_ = 1.0f;
+    }
+    cell_size = cell_size_;
+    rcp_cell_size = 1.0f / cell_size;
+    for (int i = 0; i < 3; ++i) {
+        cell_max[i] = std::min<int>((int)(ext[i] * rcp_cell_size), PointGridMaxCells);
+    }
+
+    int num_buckets = 1;
+    while (num_buckets < num_points) { num_buckets <<= 1; }
+    bucket_mask = (uint32_t)(num_buckets - 1);
+
+    RawVector<int> buckets;
+    buckets.resize_discard(num_points);
+    parallel_for_blocked(0, num_points, 1024, [&](int pi, int pend) {
+        for (; pi < pend; ++pi) {
+            int c[3];
+            getCell(points[pi], c);
+            buckets[pi] = getBucket(c[0], c[1], c[2]);
+        }
+    });
+
+    // counting sort by bucket. points in a bucket keep ascending order.
+    bucket_offsets.resize_zeroclear(num_buckets + 1);
+    for (int pi = 0; pi < num_points; ++pi) {
+        ++bucket_offsets[buckets[pi] + 1];
+    }
+    for (int bi = 0; bi < num_buckets; ++bi) {
+        bucket_offsets[bi + 1] += bucket_offsets[bi];
+    }
+
+    RawVector<int> cursor;
+    cursor.assign(bucket_offsets.begin(), bucket_offsets.end() - 1);
+    entries.resize_discard(num_points);
+    for (int pi = 0; pi < num_points; ++pi) {
+        entries[cursor[buckets[pi]]++] = pi;
+    }
+}
+
+void PointGrid::gatherPointsInBox(float3 bmin, float3 bmax, RawVector<int>& dst) const
+{
+    dst.clear();
+    eachPointInBox(bmin, bmax, [&](int pi) {
+        dst.push_back(pi);
+    });
+    std::sort(dst.begin(), dst.end());
+}
+
+} // namespace mu
@@ -0,0 +1,90 @@
+#pragma once
+
+namespace mu {
+
+// hashed uniform grid over points. point indices are sorted by bucket (counting sort),
+// so each bucket is a contiguous range of 'entries'.
+// points are referenced, not copied. build() must be called again if they are modified.
+struct PointGrid
+{
+    const float3    *points = nullptr;
+    int             num_points = 0;
+    float           cell_size = 0.0f;
+    float           rcp_cell_size = 0.0f;
+    float3          bb_min = float3::zero();
+    float3          bb_max = float3::zero();
+    int             cell_max[3] = {}; // max cell coordinate of each axis
+    uint32_t        bucket_mask = 0;
+    RawVector<int>  bucket_offsets; // num_buckets + 1
+    RawVector<int>  entries;
+
+    void clear();
+    // cell_size <= 0: decide from bounds and number of points
+    void build(const float3 *points, int num_points, float cell_size = 0.0f);
+    bool empty() const { return entries.empty(); }
+
+    // Body: [](int point_index) -> void
+    // called for each point in the cells overlapped by [bmin, bmax]. points outside the box can be passed.
+    // each point is passed at most once, in no particular order.
+    template<class Body>
+    void eachPointInBox(float3 bmin, float3 bmax, const Body& body) const;
+
+    // candidates of eachPointInBox() in ascending order
+    void gatherPointsInBox(float3 bmin, float3 bmax, RawVector<int>& dst) const;
+
+private:
+    void getCell(const float3& p, int (&c)[3]) const
+    {
+        for (int i = 0; i < 3; ++i) {
+            float f = (p[i] - bb_min[i]) * rcp_cell_size;
+            c[i] = (int)std::min<float>(std::max<float>(f, 0.0f), (float)cell_max[i]);
+        }
+    }
+    int getBucket(int x, int y, int z) const
+    {
+        uint32_t h = ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u);
+        return (int)(h & bucket_mask);
+    }
+};
+
+
+template<class Body>
+inline void PointGrid::eachPointInBox(float3 bmin, float3 bmax, const Body& body) const
+{
+    if (empty()) { return; }
+    for (int i = 0; i < 3; ++i) {
+        if (bmax[i] < bb_min[i] || bmin[i] > bb_max[i]) { return; }
+    }
+
+    int cmin[3], cmax[3];
+    getCell(bmin, cmin);
+    getCell(bmax, cmax);
+
+    // too many cells to visit. scanning all points is cheaper
+    int64_t num_cells = int64_t(cmax[0] - cmin[0] + 1) * int64_t(cmax[1] - cmin[1] + 1) * int64_t(cmax[2] - cmin[2] + 1);
+    if (num_cells > (int64_t)num_points) {
+        for (int pi = 0; pi < num_points; ++pi) { body(pi); }
+        return;
+    }
+
+    for (int z = cmin[2]; z <= cmax[2]; ++z) {
+        for (int y = cmin[1]; y <= cmax[1]; ++y) {
+            for (int x = cmin[0]; x <= cmax[0]; ++x) {
+                int bi = getBucket(x, y, z);
+                int begin = bucket_offsets[bi];
+                int end = bucket_offsets[bi + 1];
+                for (int ei = begin; ei < end; ++ei) {
+                    // buckets are shared by multiple cells. skip points in other cells.
+                    int pi = entries[ei];
+                    int c[3];
+                    getCell(points[pi], c);
+                    if (c[0] == x && c[1] == y && c[2] == z) {
+                        body(pi);
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace mu
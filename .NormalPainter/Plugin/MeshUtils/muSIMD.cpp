@@ -2,6 +2,13 @@
 #include "muMath.h"
 #include "muSIMD.h"
 #include "muRawVector.h"
+#ifdef muEnableISPC
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
 
 namespace mu {
 
@@ -9,6 +16,24 @@ namespace mu {
 #ifdef muEnableISPC
 #include "MeshUtilsCore.h"
 
+// ISPC kernels are built for multiple targets (see cmake/ISPC.cmake) and ISPC picks the best one
+// for the CPU at runtime. but it aborts if the CPU doesn't support even the lowest target (SSE4).
+// such CPUs use the generic versions instead.
+static bool ISPCAvailable()
+{
+    static const bool s_available = []() {
+        unsigned int regs[4] = {};
+#ifdef _MSC_VER
+        __cpuid((int*)regs, 1);
+#else
+        __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+        const unsigned int sse41 = 1 << 19, sse42 = 1 << 20;
+        return (regs[2] & (sse41 | sse42)) == (sse41 | sse42);
+    }();
+    return s_available;
+}
+
 #ifdef muEnableHalf
 #ifdef muSIMD_FloatToHalf
 void FloatToHalf_ISPC(half *dst, const float *src, size_t num)
@@ -243,96 +268,105 @@ void GenerateTangentsTriangleSoA_ISPC(float4 *dst,
 #endif // muEnableISPC
 
 
+// use the ISPC version if it is enabled in muSIMDConfig.h and the CPU can run it. otherwise fall through to the generic one.
 #ifdef muEnableISPC
-    #define Forward(Name, ...) Name##_ISPC(__VA_ARGS__)
+    #define Forward(Name, ...) if (ISPCAvailable()) { return Name##_ISPC(__VA_ARGS__); }
 #else
-    #define Forward(Name, ...) Name##_Generic(__VA_ARGS__)
+    #define Forward(Name, ...)
 #endif
 
 #ifdef muEnableHalf
-#if defined(muSIMD_FloatToHalf) || !defined(muEnableISPC)
 void FloatToHalf(half *dst, const float *src, size_t num)
 {
+#ifdef muSIMD_FloatToHalf
     Forward(FloatToHalf, dst, src, num);
-}
 #endif
-#if defined(muSIMD_HalfToFloat) || !defined(muEnableISPC)
+    FloatToHalf_Generic(dst, src, num);
+}
 void HalfToFloat(float *dst, const half *src, size_t num)
 {
+#ifdef muSIMD_HalfToFloat
     Forward(HalfToFloat, dst, src, num);
-}
 #endif
+    HalfToFloat_Generic(dst, src, num);
+}
 #endif // muEnableHalf
 
-#if defined(muSIMD_InvertX3) || !defined(muEnableISPC)
 void InvertX(float3 *dst, size_t num)
 {
+#ifdef muSIMD_InvertX3
     Forward(InvertX, dst, num);
-}
 #endif
-#if defined(muSIMD_InvertX4) || !defined(muEnableISPC)
+    InvertX_Generic(dst, num);
+}
 void InvertX(float4 *dst, size_t num)
 {
+#ifdef muSIMD_InvertX4
     Forward(InvertX, dst, num);
-}
 #endif
+    InvertX_Generic(dst, num);
+}
 
-#if defined(muSIMD_Scale) || !defined(muEnableISPC)
 void Scale(float *dst, float s, size_t num)
 {
+#ifdef muSIMD_Scale
     Forward(Scale, dst, s, num);
-}
 #endif
-#if defined(muSIMD_Scale) || !defined(muEnableISPC)
+    Scale_Generic(dst, s, num);
+}
 void Scale(float3 *dst, float s, size_t num)
 {
+#ifdef muSIMD_Scale
     Forward(Scale, dst, s, num);
-}
 #endif
+    Scale_Generic(dst, s, num);
+}
 
-#if defined(muSIMD_Normalize) || !defined(muEnableISPC)
 void Normalize(float3 *dst, size_t num)
 {
+#ifdef muSIMD_Normalize
     Forward(Normalize, dst, num);
-}
 #endif
+    Normalize_Generic(dst, num);
+}
 
-#if defined(muSIMD_Lerp) || !defined(muEnableISPC)
 void Lerp(float *dst, const float *src1, const float *src2, size_t num, float w)
 {
+#ifdef muSIMD_Lerp
     Forward(Lerp, dst, src1, src2, num, w);
-}
 #endif
-#if defined(muSIMD_Lerp) || !defined(muEnableISPC)
+    Lerp_Generic(dst, src1, src2, num, w);
+}
 void Lerp(float2 *dst, const float2 *src1, const float2 *src2, size_t num, float w)
 {
     Lerp((float*)dst, (const float*)src1, (const float*)src2, num * 2, w);
 }
-#endif
-#if defined(muSIMD_Lerp) || !defined(muEnableISPC)
 void Lerp(float3 *dst, const float3 *src1, const float3 *src2, size_t num, float w)
 {
     Lerp((float*)dst, (const float*)src1, (const float*)src2, num * 3, w);
 }
-#endif
 
-#if defined(muSIMD_MinMax2) || !defined(muEnableISPC)
 void MinMax(const float2 *p, size_t num, float2& dst_min, float2& dst_max)
 {
+#ifdef muSIMD_MinMax2
     Forward(MinMax, p, num, dst_min, dst_max);
-}
 #endif
-#if defined(muSIMD_MinMax3) || !defined(muEnableISPC)
+    MinMax_Generic(p, num, dst_min, dst_max);
+}
 void MinMax(const float3 *p, size_t num, float3& dst_min, float3& dst_max)
 {
+#ifdef muSIMD_MinMax3
     Forward(MinMax, p, num, dst_min, dst_max);
-}
 #endif
+    MinMax_Generic(p, num, dst_min, dst_max);
+}
 
-#if defined(muSIMD_NearEqual) || !defined(muEnableISPC)
 bool NearEqual(const float *src1, const float *src2, size_t num, float eps)
 {
-    return Forward(NearEqual, src1, src2, num, eps);
+#ifdef muSIMD_NearEqual
+    Forward(NearEqual, src1, src2, num, eps);
+#endif
+    return NearEqual_Generic(src1, src2, num, eps);
 }
 bool NearEqual(const float2 *src1, const float2 *src2, size_t num, float eps)
 {
@@ -346,109 +380,122 @@ bool NearEqual(const float4 *src1, const float4 *src2, size_t num, float eps)
 {
     return NearEqual((const float*)src1, (const float*)src2, num * 4, eps);
 }
-#endif
 
-#if defined(muSIMD_MulPoints3) || !defined(muEnableISPC)
 void MulPoints(const float4x4& m, const float3 src[], float3 dst[], size_t num_data)
 {
+#ifdef muSIMD_MulPoints3
     Forward(MulPoints, m, src, dst, num_data);
-}
 #endif
-#if defined(muSIMD_MulVectors3) || !defined(muEnableISPC)
+    MulPoints_Generic(m, src, dst, num_data);
+}
 void MulVectors(const float4x4& m, const float3 src[], float3 dst[], size_t num_data)
 {
+#ifdef muSIMD_MulVectors3
     Forward(MulVectors, m, src, dst, num_data);
-}
 #endif
+    MulVectors_Generic(m, src, dst, num_data);
+}
 
-#if defined(muSIMD_RayTrianglesIntersectionIndexed) || !defined(muEnableISPC)
 int RayTrianglesIntersectionIndexed(float3 pos, float3 dir, const float3 *vertices, const int *indices, int num_triangles, int& tindex, float& result)
 {
-    return Forward(RayTrianglesIntersectionIndexed, pos, dir, vertices, indices, num_triangles, tindex, result);
-}
+#ifdef muSIMD_RayTrianglesIntersectionIndexed
+    Forward(RayTrianglesIntersectionIndexed, pos, dir, vertices, indices, num_triangles, tindex, result);
 #endif
-#if defined(muSIMD_RayTrianglesIntersectionFlattened) || !defined(muEnableISPC)
+    return RayTrianglesIntersectionIndexed_Generic(pos, dir, vertices, indices, num_triangles, tindex, result);
+}
 int RayTrianglesIntersectionFlattened(float3 pos, float3 dir, const float3 *vertices, int num_triangles, int& tindex, float& result)
 {
-    return Forward(RayTrianglesIntersectionFlattened, pos, dir, vertices, num_triangles, tindex, result);
-}
+#ifdef muSIMD_RayTrianglesIntersectionFlattened
+    Forward(RayTrianglesIntersectionFlattened, pos, dir, vertices, num_triangles, tindex, result);
 #endif
-#if defined(muSIMD_RayTrianglesIntersectionSoA) || !defined(muEnableISPC)
+    return RayTrianglesIntersectionFlattened_Generic(pos, dir, vertices, num_triangles, tindex, result);
+}
 int RayTrianglesIntersectionSoA(float3 pos, float3 dir,
     const float *v1x, const float *v1y, const float *v1z,
     const float *v2x, const float *v2y, const float *v2z,
     const float *v3x, const float *v3y, const float *v3z,
     int num_triangles, int& tindex, float& result)
 {
-    return Forward(RayTrianglesIntersectionSoA, pos, dir, v1x, v1y, v1z, v2x, v2y, v2z, v3x, v3y, v3z, num_triangles, tindex, result);
-}
+#ifdef muSIMD_RayTrianglesIntersectionSoA
+    Forward(RayTrianglesIntersectionSoA, pos, dir, v1x, v1y, v1z, v2x, v2y, v2z, v3x, v3y, v3z, num_triangles, tindex, result);
 #endif
+    return RayTrianglesIntersectionSoA_Generic(pos, dir, v1x, v1y, v1z, v2x, v2y, v2z, v3x, v3y, v3z, num_triangles, tindex, result);
+}
 
-#if defined(muSIMD_PolyInside) || !defined(muEnableISPC)
 bool PolyInside(const float2 poly[], int ngon, const float2 minp, const float2 maxp, const float2 pos)
 {
-    return Forward(PolyInside, poly, ngon, minp, maxp, pos);
-}
+#ifdef muSIMD_PolyInside
+    Forward(PolyInside, poly, ngon, minp, maxp, pos);
 #endif
-#if defined(muSIMD_PolyInside) || !defined(muEnableISPC)
+    return PolyInside_Generic(poly, ngon, minp, maxp, pos);
+}
 bool PolyInside(const float2 poly[], int ngon, const float2 pos)
 {
-    return Forward(PolyInside, poly, ngon, pos);
-}
+#ifdef muSIMD_PolyInside
+    Forward(PolyInside, poly, ngon, pos);
 #endif
-#if defined(muSIMD_PolyInsideSoA) || !defined(muEnableISPC)
+    return PolyInside_Generic(poly, ngon, pos);
+}
 bool PolyInside(const float px[], const float py[], int ngon, const float2 minp, const float2 maxp, const float2 pos)
 {
-    return Forward(PolyInside, px, py, ngon, minp, maxp, pos);
-}
+#ifdef muSIMD_PolyInsideSoA
+    Forward(PolyInside, px, py, ngon, minp, maxp, pos);
 #endif
+    return PolyInside_Generic(px, py, ngon, minp, maxp, pos);
+}
 
-#if defined(muSIMD_GenerateNormalsTriangleIndexed) || !defined(muEnableISPC)
 void GenerateNormalsTriangleIndexed(float3 *dst,
     const float3 *vertices, const int *indices, int num_triangles, int num_vertices)
 {
-    return Forward(GenerateNormalsTriangleIndexed, dst, vertices, indices, num_triangles, num_vertices);
-}
+#ifdef muSIMD_GenerateNormalsTriangleIndexed
+    Forward(GenerateNormalsTriangleIndexed, dst, vertices, indices, num_triangles, num_vertices);
 #endif
-#if defined(muSIMD_GenerateNormalsTriangleFlattened) || !defined(muEnableISPC)
+    return GenerateNormalsTriangleIndexed_Generic(dst, vertices, indices, num_triangles, num_vertices);
+}
 void GenerateNormalsTriangleFlattened(float3 *dst,
     const float3 *vertices, const int *indices,
     int num_triangles, int num_vertices)
 {
-    return Forward(GenerateNormalsTriangleFlattened, dst, vertices, indices, num_triangles, num_vertices);
-}
+#ifdef muSIMD_GenerateNormalsTriangleFlattened
+    Forward(GenerateNormalsTriangleFlattened, dst, vertices, indices, num_triangles, num_vertices);
 #endif
-#if defined(muSIMD_GenerateNormalsTriangleSoA) || !defined(muEnableISPC)
+    return GenerateNormalsTriangleFlattened_Generic(dst, vertices, indices, num_triangles, num_vertices);
+}
 void GenerateNormalsTriangleSoA(float3 *dst,
     const float *v1x, const float *v1y, const float *v1z,
     const float *v2x, const float *v2y, const float *v2z,
     const float *v3x, const float *v3y, const float *v3z,
     const int *indices, int num_triangles, int num_vertices)
 {
-    return Forward(GenerateNormalsTriangleSoA, dst,
+#ifdef muSIMD_GenerateNormalsTriangleSoA
+    Forward(GenerateNormalsTriangleSoA, dst,
         v1x, v1y, v1z, v2x, v2y, v2z, v3x, v3y, v3z,
         indices, num_triangles, num_vertices);
-}
 #endif
+    return GenerateNormalsTriangleSoA_Generic(dst,
+        v1x, v1y, v1z, v2x, v2y, v2z, v3x, v3y, v3z,
+        indices, num_triangles, num_vertices);
+}
 
 
-#if defined(muSIMD_GenerateTangentsTriangleIndexed) || !defined(muEnableISPC)
 void GenerateTangentsTriangleIndexed(float4 *dst,
     const float3 *vertices, const float2 *uv, const float3 *normals, const int *indices,
     int num_triangles, int num_vertices)
 {
-    return Forward(GenerateTangentsTriangleIndexed, dst, vertices, uv, normals, indices, num_triangles, num_vertices);
-}
+#ifdef muSIMD_GenerateTangentsTriangleIndexed
+    Forward(GenerateTangentsTriangleIndexed, dst, vertices, uv, normals, indices, num_triangles, num_vertices);
 #endif
-#if defined(muSIMD_GenerateTangentsTriangleFlattened) || !defined(muEnableISPC)
+    return GenerateTangentsTriangleIndexed_Generic(dst, vertices, uv, normals, indices, num_triangles, num_vertices);
+}
 void GenerateTangentsTriangleFlattened(float4 *dst,
     const float3 *vertices, const float2 *uv, const float3 *normals, const int *indices,
     int num_triangles, int num_vertices)
 {
-    return Forward(GenerateTangentsTriangleFlattened, dst, vertices, uv, normals, indices, num_triangles, num_vertices);
-}
+#ifdef muSIMD_GenerateTangentsTriangleFlattened
+    Forward(GenerateTangentsTriangleFlattened, dst, vertices, uv, normals, indices, num_triangles, num_vertices);
 #endif
-#if defined(muSIMD_GenerateTangentsTriangleSoA) || !defined(muEnableISPC)
+    return GenerateTangentsTriangleFlattened_Generic(dst, vertices, uv, normals, indices, num_triangles, num_vertices);
+}
 void GenerateTangentsTriangleSoA(float4 *dst,
     const float *v1x, const float *v1y, const float *v1z,
     const float *v2x, const float *v2y, const float *v2z,
@@ -459,12 +506,17 @@ void GenerateTangentsTriangleSoA(float4 *dst,
     const float3 *normals,
     const int *indices, int num_triangles, int num_vertices)
 {
-    return Forward(GenerateTangentsTriangleSoA, dst,
+#ifdef muSIMD_GenerateTangentsTriangleSoA
+    Forward(GenerateTangentsTriangleSoA, dst,
         v1x, v1y, v1z, v2x, v2y, v2z, v3x, v3y, v3z,
         u1x, u1y, u2x, u2y, u3x, u3y,
         normals, indices, num_triangles, num_vertices);
-}
 #endif
+    return GenerateTangentsTriangleSoA_Generic(dst,
+        v1x, v1y, v1z, v2x, v2y, v2z, v3x, v3y, v3z,
+        u1x, u1y, u2x, u2y, u3x, u3y,
+        normals, indices, num_triangles, num_vertices);
+}
 
 #undef Forward
 } // namespace mu
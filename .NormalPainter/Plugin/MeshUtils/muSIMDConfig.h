@@ -1,5 +1,9 @@
 #pragma once
 
+// ISPC kernels to use. disabled ones fall back to the *_Generic versions.
+// enable a kernel only after TestMeshUtils has validated it on an ISPC build.
+// FloatToHalf / HalfToFloat: ISPC's conversion may round differently from OpenEXR's half.
+
 //#define muSIMD_FloatToHalf
 //#define muSIMD_HalfToFloat
 
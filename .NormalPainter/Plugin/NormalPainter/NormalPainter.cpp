@@ -1,32 +1,9 @@
 #include "pch.h"
 #include "NormalPainter.h"
+#include "npModelCache.h"
 
 #define npEpsilon 0.0000001f
 
-struct npMeshData
-{
-    int         *indices = nullptr;
-    float3      *vertices = nullptr;
-    float3      *normals = nullptr;
-    float4      *tangents = nullptr;
-    float2      *uv = nullptr;
-    float       *selection = nullptr;
-    int         num_vertices = 0;
-    int         num_triangles = 0;
-    float4x4    transform = float4x4::identity();
-};
-
-struct npSkinData
-{
-    Weights4    *weights = nullptr;
-    float4x4    *bones = nullptr;
-    float4x4    *bindposes = nullptr;
-    int         num_vertices = 0;
-    int         num_bones = 0;
-    float4x4    root = float4x4::identity();
-};
-
-
 inline static int Raycast(
     const npMeshData& model, const float3 pos, const float3 dir, int& tindex, float& distance)
 {
@@ -34,7 +11,7 @@ inline static int Raycast(
     float3 rpos = mul_p(itrans, pos);
     float3 rdir = normalize(mul_v(itrans, dir));
     float d;
-    int hit = RayTrianglesIntersectionIndexed(rpos, rdir, model.vertices, model.indices, model.num_triangles, tindex, d);
+    int hit = npGetModelCache(model)->getBVH().raycast(rpos, rdir, tindex, d);
     if (hit) {
         float3 hpos = rpos + rdir * d;
         distance = length(mul_p(model.transform, hpos) - pos);
@@ -43,10 +20,10 @@ inline static int Raycast(
 }
 
 inline static int RaycastWithoutTransform(
-    const npMeshData& model, const float3 pos, const float3 dir, int& tindex, float& distance)
+    const TriangleBVH& bvh, const float3 pos, const float3 dir, int& tindex, float& distance)
 {
     float d;
-    int hit = RayTrianglesIntersectionIndexed(pos, dir, model.vertices, model.indices, model.num_triangles, tindex, d);
+    int hit = bvh.raycast(pos, dir, tindex, d);
     if (hit) {
         float3 hpos = pos + dir * d;
         distance = length(hpos - pos);
@@ -54,15 +31,28 @@ inline static int RaycastWithoutTransform(
     return hit;
 }
 
-#define npVertexBlockSize 1024
-
+// candidates_out: receives vertices that may have been passed to body (ascending order)
 template<class Body>
-inline static int SelectInside(const npMeshData& model, float3 pos, float radius, const Body& body, bool parallel = false)
+inline static int SelectInside(const npMeshData& model, float3 pos, float radius, const Body& body, bool parallel = false,
+    RawVector<int> *candidates_out = nullptr)
 {
-    auto num_vertices = model.num_vertices;
     auto vertices = model.vertices;
     auto transform = model.transform;
 
+    // pick candidates from the grid by model-space bounds of the sphere
+    RawVector<int> candidates;
+    {
+        auto itrans = invert(transform);
+        float3 lpos = mul_p(itrans, pos);
+        float3 lext = float3{
+            length(float3{ itrans[0][0], itrans[1][0], itrans[2][0] }),
+            length(float3{ itrans[0][1], itrans[1][1], itrans[2][1] }),
+            length(float3{ itrans[0][2], itrans[1][2], itrans[2][2] }),
+        } * (radius * 1.001f);
+        npGetModelCache(model)->getPointGrid().gatherPointsInBox(lpos - lext, lpos + lext, candidates);
+    }
+    int num_candidates = (int)candidates.size();
+
     float rq = radius * radius;
     auto do_select = [&](int vi) -> bool {
         float3 p = mul_p(transform, vertices[vi]);
@@ -74,53 +64,57 @@ inline static int SelectInside(const npMeshData& model, float3 pos, float radius
         return false;
     };
 
+    int ret = 0;
     if (parallel) {
-        std::atomic_int ret{ 0 };
-        parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
+        ret = parallel_reduce(0, num_candidates, npVertexBlockSize, 0, [&](int ci, int cend) {
             int c = 0;
-            for (; vi < vend; ++vi) {
-                if (do_select(vi)) {
+            for (; ci < cend; ++ci) {
+                if (do_select(candidates[ci])) {
                     ++c;
                 }
             }
-            ret += c;
-        });
-        return ret;
+            return c;
+        }, std::plus<int>());
     }
     else {
-        int ret = 0;
-        for (int vi = 0; vi < num_vertices; ++vi) {
-            if (do_select(vi)) {
+        for (int ci = 0; ci < num_candidates; ++ci) {
+            if (do_select(candidates[ci])) {
                 ++ret;
             }
         }
-        return ret;
     }
+    if (candidates_out) {
+        candidates_out->swap(candidates);
+    }
+    return ret;
 }
 
-static bool GetFurthestDistance(const npMeshData& model, float3 pos, bool mask, int &vidx, float &dist)
+// furthest vertex in 'selected' (ascending vertex indices) from pos
+static bool GetFurthestDistance(const npMeshData& model, const RawVector<int>& selected, float3 pos, int &vidx, float &dist)
 {
-    auto num_vertices = model.num_vertices;
     auto vertices = model.vertices;
-    auto selection = model.selection;
-
-    float furthest_sq = FLT_MIN;
-    int furthest_vi;
 
+    // furthest vertex of each block. ties are resolved to the smaller index as a serial loop does.
+    struct Furthest { float dsq; int vi; };
     float3 lpos = mul_p(invert(model.transform), pos);
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        if (!mask || selection[vi] > 0.0f) {
-            float dsq = length_sq(vertices[vi] - lpos);
-            if (dsq > furthest_sq) {
-                furthest_sq = dsq;
-                furthest_vi = vi;
+    auto furthest = parallel_reduce(0, (int)selected.size(), npVertexBlockSize, Furthest{ FLT_MIN, -1 },
+        [&](int si, int send) {
+            Furthest r{ FLT_MIN, -1 };
+            for (; si < send; ++si) {
+                int vi = selected[si];
+                float dsq = length_sq(vertices[vi] - lpos);
+                if (dsq > r.dsq) {
+                    r.dsq = dsq;
+                    r.vi = vi;
+                }
             }
-        }
-    }
+            return r;
+        },
+        [](const Furthest& a, const Furthest& b) { return b.dsq > a.dsq ? b : a; });
 
-    if (furthest_sq > FLT_MIN) {
-        dist = length(mul_p(model.transform, vertices[furthest_vi]) - pos);
-        vidx = furthest_vi;
+    if (furthest.dsq > FLT_MIN) {
+        dist = length(mul_p(model.transform, vertices[furthest.vi]) - pos);
+        vidx = furthest.vi;
         return true;
     }
     return false;
@@ -166,6 +160,8 @@ npAPI int npSelectSingle(
 
     float4x4 mvp = *mvp_;
     float3 lcampos = mul_p(invert(model->transform), campos);
+    auto cache = npGetModelCache(*model);
+    auto *bvh = frontface_only ? &cache->getBVH() : nullptr;
     float2 rcenter = (rmin + rmax) * 0.5f;
 
     const int max_inside = 64;
@@ -187,7 +183,7 @@ npAPI int npSelectSingle(
                     float3 dir = normalize(vpos - lcampos);
                     int ti;
                     float distance;
-                    if (RaycastWithoutTransform(*model, lcampos, dir, ti, distance)) {
+                    if (RaycastWithoutTransform(*bvh, lcampos, dir, ti, distance)) {
                         float3 hitpos = lcampos + dir * distance;
                         if (length(vpos - hitpos) < 0.01f) {
                             hit = true;
@@ -238,6 +234,7 @@ npAPI int npSelectSingle(
         }
 
         selection[nearest_index] = clamp01(selection[nearest_index] + strength);
+        cache->updateSelectedIndices(selection, &nearest_index, 1);
         return 1;
     }
     return 0;
@@ -256,6 +253,7 @@ npAPI int npSelectTriangle(
         for (int i = 0; i < 3; ++i) {
             selection[indices[ti * 3 + i]] = clamp01(selection[indices[ti * 3 + i]] + strength);
         }
+        npGetModelCache(*model)->updateSelectedIndices(selection, &indices[ti * 3], 3);
         return 1;
     }
     return 0;
@@ -269,30 +267,25 @@ npAPI int npSelectEdge(
     auto selection = model->selection;
     int num_vertices = model->num_vertices;
 
+    auto cache = npGetModelCache(*model);
     RawVector<int> targets;
     if (mask) {
-        targets.reserve(num_vertices);
-        for (int vi = 0; vi < num_vertices; ++vi) {
-            if (selection[vi] > 0.0f) {
-                targets.push_back(vi);
-            }
-        }
+        targets = cache->getSelectedIndices(selection);
     }
     else {
-        targets.resize(num_vertices);
-        for (int vi = 0; vi < num_vertices; ++vi) {
-            targets[vi] = vi;
-        }
+        targets.resize_discard(num_vertices);
+        std::iota(targets.begin(), targets.end(), 0);
     }
 
     if (clear) { memset(selection, 0, num_vertices * 4); }
 
-    int ret = 0;
-    SelectEdge(indices, 3, vertices, targets, [&](int vi) {
+    RawVector<int> changed;
+    SelectEdge(indices, 3, vertices, cache->getConnection(), targets, [&](int vi) {
         selection[vi] = clamp01(selection[vi] + strength);
-        ++ret;
+        changed.push_back(vi);
     });
-    return ret;
+    cache->updateSelectedIndices(selection, changed.data(), (int)changed.size(), clear != 0);
+    return (int)changed.size();
 }
 
 npAPI int npSelectHole(
@@ -303,30 +296,25 @@ npAPI int npSelectHole(
     auto selection = model->selection;
     int num_vertices = model->num_vertices;
 
+    auto cache = npGetModelCache(*model);
     RawVector<int> targets;
     if (mask) {
-        targets.reserve(num_vertices);
-        for (int vi = 0; vi < num_vertices; ++vi) {
-            if (selection[vi] > 0.0f) {
-                targets.push_back(vi);
-            }
-        }
+        targets = cache->getSelectedIndices(selection);
     }
     else {
-        targets.resize(num_vertices);
-        for (int vi = 0; vi < num_vertices; ++vi) {
-            targets[vi] = vi;
-        }
+        targets.resize_discard(num_vertices);
+        std::iota(targets.begin(), targets.end(), 0);
     }
 
     if (clear) { memset(selection, 0, num_vertices * 4); }
 
-    int ret = 0;
-    SelectHole(indices, 3, vertices, targets, [&](int vi) {
+    RawVector<int> changed;
+    SelectHole(indices, 3, vertices, cache->getWeldedConnection(), targets, [&](int vi) {
         selection[vi] = clamp01(selection[vi] + strength);
-        ++ret;
+        changed.push_back(vi);
     });
-    return ret;
+    cache->updateSelectedIndices(selection, changed.data(), (int)changed.size(), clear != 0);
+    return (int)changed.size();
 }
 
 npAPI int npSelectConnected(
@@ -337,22 +325,18 @@ npAPI int npSelectConnected(
     auto selection = model->selection;
     int num_vertices = model->num_vertices;
 
-    RawVector<int> targets;
-    targets.reserve(num_vertices);
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        if (selection[vi] > 0.0f) {
-            targets.push_back(vi);
-        }
-    }
+    auto cache = npGetModelCache(*model);
+    RawVector<int> targets = cache->getSelectedIndices(selection);
 
     if (clear) { memset(selection, 0, num_vertices * 4); }
 
-    int ret = 0;
-    SelectConnected(indices, 3, vertices, targets, [&](int vi) {
+    RawVector<int> changed;
+    SelectConnected(indices, 3, vertices, cache->getConnection(), targets, [&](int vi) {
         selection[vi] = clamp01(selection[vi] + strength);
-        ++ret;
+        changed.push_back(vi);
     });
-    return ret;
+    cache->updateSelectedIndices(selection, changed.data(), (int)changed.size(), clear != 0);
+    return (int)changed.size();
 }
 
 npAPI int npSelectRect(
@@ -366,42 +350,42 @@ npAPI int npSelectRect(
 
     float4x4 mvp = *mvp_;
     float3 lcampos = mul_p(invert(model->transform), campos);
-
-    std::atomic_int ret{ 0 };
-    parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
-        int c = 0;
-        for (; vi < vend; ++vi) {
-            float4 vp = mul4(mvp, vertices[vi]);
-            float2 sp = float2{ vp.x, vp.y } / vp.w;
-            if (sp.x >= rmin.x && sp.x <= rmax.x &&
-                sp.y >= rmin.y && sp.y <= rmax.y && vp.z > 0.0f)
-            {
-                bool hit = false;
-                if (frontface_only) {
-                    float3 vpos = vertices[vi];
-                    float3 dir = normalize(vpos - lcampos);
-                    int ti;
-                    float distance;
-                    if (RaycastWithoutTransform(*model, lcampos, dir, ti, distance)) {
-                        float3 hitpos = lcampos + dir * distance;
-                        if (length(vpos - hitpos) < 0.01f) {
-                            hit = true;
-                        }
+    auto cache = npGetModelCache(*model);
+    auto *bvh = frontface_only ? &cache->getBVH() : nullptr;
+
+    RawVector<int> hits;
+    parallel_compact(0, num_vertices, npVertexBlockSize, hits, [&](int vi) {
+        float4 vp = mul4(mvp, vertices[vi]);
+        float2 sp = float2{ vp.x, vp.y } / vp.w;
+        if (sp.x >= rmin.x && sp.x <= rmax.x &&
+            sp.y >= rmin.y && sp.y <= rmax.y && vp.z > 0.0f)
+        {
+            bool hit = false;
+            if (frontface_only) {
+                float3 vpos = vertices[vi];
+                float3 dir = normalize(vpos - lcampos);
+                int ti;
+                float distance;
+                if (RaycastWithoutTransform(*bvh, lcampos, dir, ti, distance)) {
+                    float3 hitpos = lcampos + dir * distance;
+                    if (length(vpos - hitpos) < 0.01f) {
+                        hit = true;
                     }
                 }
-                else {
-                    hit = true;
-                }
-
-                if (hit) {
-                    selection[vi] = clamp01(selection[vi] + strength);
-                    ++c;
-                }
             }
+            else {
+                hit = true;
+            }
+            return hit;
         }
-        ret += c;
+        return false;
     });
-    return ret;
+
+    for (int vi : hits) {
+        selection[vi] = clamp01(selection[vi] + strength);
+    }
+    cache->updateSelectedIndices(selection, hits.data(), (int)hits.size());
+    return (int)hits.size();
 }
 
 npAPI int npSelectLasso(
@@ -417,6 +401,8 @@ npAPI int npSelectLasso(
 
     float4x4 mvp = *mvp_;
     float3 lcampos = mul_p(invert(model->transform), campos);
+    auto cache = npGetModelCache(*model);
+    auto *bvh = frontface_only ? &cache->getBVH() : nullptr;
 
     float2 minp, maxp;
     MinMax(lasso, num_lasso_points, minp, maxp);
@@ -428,39 +414,37 @@ npAPI int npSelectLasso(
         polyy[i] = lasso[i].y;
     }
 
-    std::atomic_int ret{ 0 };
-    parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
-        int c = 0;
-        for (; vi < vend; ++vi) {
-            float4 vp = mul4(mvp, vertices[vi]);
-            float2 sp = float2{ vp.x, vp.y } / vp.w;
-            if (PolyInside(polyx.data(), polyy.data(), num_lasso_points, minp, maxp, sp)) {
-                bool hit = false;
-                if (frontface_only) {
-                    float3 vpos = vertices[vi];
-                    float3 dir = normalize(vpos - lcampos);
-                    int ti;
-                    float distance;
-                    if (RaycastWithoutTransform(*model, lcampos, dir, ti, distance)) {
-                        float3 hitpos = lcampos + dir * distance;
-                        if (length(vpos - hitpos) < 0.01f) {
-                            hit = true;
-                        }
+    RawVector<int> hits;
+    parallel_compact(0, num_vertices, npVertexBlockSize, hits, [&](int vi) {
+        float4 vp = mul4(mvp, vertices[vi]);
+        float2 sp = float2{ vp.x, vp.y } / vp.w;
+        if (PolyInside(polyx.data(), polyy.data(), num_lasso_points, minp, maxp, sp)) {
+            bool hit = false;
+            if (frontface_only) {
+                float3 vpos = vertices[vi];
+                float3 dir = normalize(vpos - lcampos);
+                int ti;
+                float distance;
+                if (RaycastWithoutTransform(*bvh, lcampos, dir, ti, distance)) {
+                    float3 hitpos = lcampos + dir * distance;
+                    if (length(vpos - hitpos) < 0.01f) {
+                        hit = true;
                     }
                 }
-                else {
-                    hit = true;
-                }
-
-                if (hit) {
-                    selection[vi] = clamp01(selection[vi] + strength);
-                    ++c;
-                }
             }
+            else {
+                hit = true;
+            }
+            return hit;
         }
-        ret += c;
+        return false;
     });
-    return ret;
+
+    for (int vi : hits) {
+        selection[vi] = clamp01(selection[vi] + strength);
+    }
+    cache->updateSelectedIndices(selection, hits.data(), (int)hits.size());
+    return (int)hits.size();
 }
 
 npAPI int npSelectBrush(
@@ -469,43 +453,48 @@ npAPI int npSelectBrush(
 {
     auto selection = model->selection;
 
-    return SelectInside(*model, pos, radius, [&](int vi, float d, float3 p) {
+    RawVector<int> candidates;
+    int ret = SelectInside(*model, pos, radius, [&](int vi, float d, float3 p) {
         float s = GetBrushSample(d, radius, bsamples, num_bsamples) * strength;
         selection[vi] = clamp01(selection[vi] + s);
-    }, true);
+    }, true, &candidates);
+    npGetModelCache(*model)->updateSelectedIndices(selection, candidates.data(), (int)candidates.size());
+    return ret;
 }
 
 npAPI int npUpdateSelection(
     npMeshData *model,
     float3 *selection_pos, float3 *selection_normal)
 {
-    auto num_vertices = model->num_vertices;
-    auto vertices = model->vertices;
     auto normals = model->normals;
     auto selection = model->selection;
 
-    float st = 0.0f;
-    int num_selected = 0;
     float3 spos = float3::zero();
     float3 snormal = float3::zero();
-    quatf srot = quatf::identity();
-
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        float s = selection[vi];
-        if (s > 0.0f) {
-            spos += vertices[vi] * s;
-            snormal += normals[vi] * s;
-            ++num_selected;
-            st += s;
-        }
-    }
 
+    // the weighted sum of positions is maintained by the cache as selection changes.
+    // normals are modified by many operations and summed here.
+    auto cache = npGetModelCache(*model);
+    auto& selected = cache->getSelectedIndices(selection);
+    int num_selected = (int)selected.size();
     if (num_selected > 0) {
+        double st;
+        double3 sp;
+        cache->getSelectionSums(selection, st, sp);
+        snormal = parallel_reduce(0, num_selected, npVertexBlockSize, float3::zero(), [&](int si, int send) {
+            float3 r = float3::zero();
+            for (; si < send; ++si) {
+                int vi = selected[si];
+                r += normals[vi] * selection[vi];
+            }
+            return r;
+        }, std::plus<float3>());
+
         auto trans = model->transform;
-        spos /= st;
+        sp /= st;
+        spos.assign(sp);
         spos = mul_p(trans, spos);
         snormal = normalize(mul_v(trans, snormal));
-        srot = to_quat(look33(snormal, {0,1,0}));
     }
 
     *selection_pos = spos;
@@ -514,36 +503,82 @@ npAPI int npUpdateSelection(
 }
 
 
+// selected vertices are transformed in tiles. normals (and positions) of a tile are transposed into SoA
+// and kernels process all lanes without branches, so that compilers can vectorize them.
+#define npSoATileSize 64
+
+struct npSoATile
+{
+    float nx[npSoATileSize], ny[npSoATileSize], nz[npSoATileSize];
+    float px[npSoATileSize], py[npSoATileSize], pz[npSoATileSize];
+    float s[npSoATileSize];
+    int mask[npSoATileSize]; // only masked lanes are written back. all lanes are masked initially.
+
+    float3 getNormal(int i) const { return { nx[i], ny[i], nz[i] }; }
+    float3 getPoint(int i) const { return { px[i], py[i], pz[i] }; }
+    void setNormal(int i, float3 v) { nx[i] = v.x; ny[i] = v.y; nz[i] = v.z; }
+};
+
+// Kernel: [](npSoATile& tile, int num_lanes) -> void
+// tiles are gathered from selected vertices only. unselected vertices are not touched.
+template<class Kernel>
+static void EachSelectedTile(npMeshData& model, const RawVector<int>& selected, bool load_points, const Kernel& kernel)
+{
+    auto vertices = model.vertices;
+    auto normals = model.normals;
+    auto selection = model.selection;
+
+    parallel_for_blocked(0, (int)selected.size(), npVertexBlockSize, [&](int si, int send) {
+        npSoATile tile;
+        for (; si < send; si += npSoATileSize) {
+            int num = std::min<int>(send - si, npSoATileSize);
+            const int *vis = &selected[si];
+
+            for (int i = 0; i < num; ++i) {
+                tile.s[i] = selection[vis[i]];
+                tile.mask[i] = 1;
+                tile.setNormal(i, normals[vis[i]]);
+            }
+            if (load_points) {
+                for (int i = 0; i < num; ++i) {
+                    auto& p = vertices[vis[i]];
+                    tile.px[i] = p.x; tile.py[i] = p.y; tile.pz[i] = p.z;
+                }
+            }
+
+            kernel(tile, num);
+
+            for (int i = 0; i < num; ++i) {
+                if (tile.mask[i]) {
+                    normals[vis[i]] = tile.getNormal(i);
+                }
+            }
+        }
+    });
+}
+
 npAPI void npAssign(
     npMeshData *model, float3 value)
 {
-    auto num_vertices = model->num_vertices;
-    auto normals = model->normals;
-    auto selection = model->selection;
-
     value = mul_v(invert(model->transform), value);
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        float s = selection[vi];
-        if (s == 0.0f) continue;
-
-        normals[vi] = normalize(lerp(normals[vi], value, s));
-    }
+    auto& selected = npGetModelCache(*model)->getSelectedIndices(model->selection);
+    EachSelectedTile(*model, selected, false, [&](npSoATile& t, int num) {
+        for (int i = 0; i < num; ++i) {
+            t.setNormal(i, normalize(lerp(t.getNormal(i), value, t.s[i])));
+        }
+    });
 }
 
 npAPI void npMove(
     npMeshData *model, float3 value)
 {
-    auto num_vertices = model->num_vertices;
-    auto normals = model->normals;
-    auto selection = model->selection;
-
     value = mul_v(invert(model->transform), value);
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        float s = selection[vi];
-        if (s == 0.0f) continue;
-
-        normals[vi] = normalize(normals[vi] + value * s);
-    }
+    auto& selected = npGetModelCache(*model)->getSelectedIndices(model->selection);
+    EachSelectedTile(*model, selected, false, [&](npSoATile& t, int num) {
+        for (int i = 0; i < num; ++i) {
+            t.setNormal(i, normalize(t.getNormal(i) + value * t.s[i]));
+        }
+    });
 }
 
 npAPI void npRotate(
@@ -556,10 +591,6 @@ npAPI void npRotate(
         return;
     }
 
-    auto num_vertices = model->num_vertices;
-    auto normals = model->normals;
-    auto selection = model->selection;
-
     auto ptrans = to_mat4x4(invert(pivot_rot));
     auto iptrans = invert(ptrans);
     auto trans = model->transform;
@@ -568,14 +599,14 @@ npAPI void npRotate(
 
     auto to_lspace = trans * iptrans * rot * ptrans * itrans;
 
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        float s = selection[vi];
-        if (s == 0.0f) continue;
-
-        float3 n = normals[vi];
-        float3 v = normalize(mul_v(to_lspace, n));
-        normals[vi] = normalize(lerp(n, v, s));
-    }
+    auto& selected = npGetModelCache(*model)->getSelectedIndices(model->selection);
+    EachSelectedTile(*model, selected, false, [&](npSoATile& t, int num) {
+        for (int i = 0; i < num; ++i) {
+            float3 n = t.getNormal(i);
+            float3 v = normalize(mul_v(to_lspace, n));
+            t.setNormal(i, normalize(lerp(n, v, t.s[i])));
+        }
+    });
 }
 
 npAPI void npRotatePivot(
@@ -588,17 +619,13 @@ npAPI void npRotatePivot(
         return;
     }
 
+    auto& selected = npGetModelCache(*model)->getSelectedIndices(model->selection);
     float furthest;
     int furthest_idx;
-    if (!GetFurthestDistance(*model, pivot_pos, true, furthest_idx, furthest)) {
+    if (!GetFurthestDistance(*model, selected, pivot_pos, furthest_idx, furthest)) {
         return;
     }
 
-    auto num_vertices = model->num_vertices;
-    auto vertices = model->vertices;
-    auto normals = model->normals;
-    auto selection = model->selection;
-
     auto ptrans = to_mat4x4(invert(pivot_rot)) * translate(pivot_pos);
     auto iptrans = invert(ptrans);
     auto trans = model->transform;
@@ -608,33 +635,29 @@ npAPI void npRotatePivot(
     auto to_lspace = ptrans * itrans;
     auto rot = to_mat3x3(value);
 
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        float s = selection[vi];
-        if (s == 0.0f) continue;
-
-        float3 vpos = mul_p(to_pspace, vertices[vi]);
-        float d = length(vpos);
-        float3 v = vpos - (rot * vpos);
-        if(near_equal(length(v), 0.0f)) { continue; }
-        v = normalize(mul_v(to_lspace, v));
-        normals[vi] = normalize(normals[vi] + v * (d / furthest * angle * s));
-    }
+    EachSelectedTile(*model, selected, true, [&](npSoATile& t, int num) {
+        for (int i = 0; i < num; ++i) {
+            float3 vpos = mul_p(to_pspace, t.getPoint(i));
+            float d = length(vpos);
+            float3 v = vpos - (rot * vpos);
+            // vertices on the rotation axis are not affected
+            t.mask[i] &= (int)!near_equal(length(v), 0.0f);
+            v = normalize(mul_v(to_lspace, v));
+            t.setNormal(i, normalize(t.getNormal(i) + v * (d / furthest * angle * t.s[i])));
+        }
+    });
 }
 
 npAPI void npScale(
     npMeshData *model, float3 value, float3 pivot_pos, quatf pivot_rot)
 {
+    auto& selected = npGetModelCache(*model)->getSelectedIndices(model->selection);
     float furthest;
     int furthest_idx;
-    if (!GetFurthestDistance(*model, pivot_pos, true, furthest_idx, furthest)) {
+    if (!GetFurthestDistance(*model, selected, pivot_pos, furthest_idx, furthest)) {
         return;
     }
 
-    auto num_vertices = model->num_vertices;
-    auto vertices = model->vertices;
-    auto normals = model->normals;
-    auto selection = model->selection;
-
     auto ptrans = to_mat4x4(invert(pivot_rot)) * translate(pivot_pos);
     auto iptrans = invert(ptrans);
     auto trans = model->transform;
@@ -643,47 +666,64 @@ npAPI void npScale(
     auto to_pspace = trans * iptrans;
     auto to_lspace = ptrans * itrans;
 
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        float s = selection[vi];
-        if (s == 0.0f) continue;
-
-        float3 vpos = mul_p(to_pspace, vertices[vi]);
-        float d = length(vpos);
-        float3 v = mul_v(to_lspace, (vpos / d) * value);
-        normals[vi] = normalize(normals[vi] + v * (d / furthest * s));
-    }
+    EachSelectedTile(*model, selected, true, [&](npSoATile& t, int num) {
+        for (int i = 0; i < num; ++i) {
+            float3 vpos = mul_p(to_pspace, t.getPoint(i));
+            float d = length(vpos);
+            float3 v = mul_v(to_lspace, (vpos / d) * value);
+            t.setNormal(i, normalize(t.getNormal(i) + v * (d / furthest * t.s[i])));
+        }
+    });
 }
 
 npAPI void npSmooth(
-    npMeshData *model, float radius, float strength, int mask)
+    npMeshData *model, float radius, float strength, int iterations, int mask)
 {
     auto num_vertices = model->num_vertices;
-    auto vertices = model->vertices;
     auto normals = model->normals;
     auto selection = model->selection;
 
-    RawVector<float3> tvertices;
-    tvertices.resize(num_vertices);
-    parallel_for(0, num_vertices, [&](int vi) {
-        tvertices[vi] = mul_p(model->transform, vertices[vi]);
-    });
+    // world-space vertices and grid with cells of the size of radius. a query visits 3x3x3 cells.
+    auto cache = npGetModelCache(*model);
+    auto& tvertices = cache->getTransformedVertices(model->transform);
+    PointGrid grid;
+    grid.build(tvertices.data(), num_vertices, radius);
 
+    // each iteration reads the result of the previous one. results don't depend on processing order.
+    RawVector<float3> src;
     float rsq = radius * radius;
-    parallel_for(0, num_vertices, [&](int vi) {
-        float s = mask ? selection[vi] : 1.0f;
-        if (s == 0.0f) { return; }
-
-        float3 p = tvertices[vi];
-        float3 average = float3::zero();
-        for (int i = 0; i < num_vertices; ++i) {
-            float s2 = selection ? selection[i] : 1.0f;
-            float dsq = length_sq(tvertices[i] - p);
-            if (dsq <= rsq) {
-                average += normals[i] * s2;
+    for (int it = 0; it < std::max<int>(iterations, 1); ++it) {
+        src.assign(normals, normals + num_vertices);
+        parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
+            for (; vi < vend; ++vi) {
+                float s = mask ? selection[vi] : 1.0f;
+                if (s == 0.0f) { continue; }
+
+                float3 p = tvertices[vi];
+                float3 average = float3::zero();
+                grid.eachPointInBox(p - radius, p + radius, [&](int i) {
+                    float s2 = mask ? selection[i] : 1.0f;
+                    float dsq = length_sq(tvertices[i] - p);
+                    if (dsq <= rsq) {
+                        average += src[i] * s2;
+                    }
+                });
+                average = normalize(average);
+                normals[vi] = normalize(src[vi] + average * (strength * s));
             }
+        });
+    }
+}
+
+// Body: [](int vertex_index) -> void
+template<class Body>
+inline static void EachCoincidentVertex(const PointGrid& grid, const float3 *vertices, int vi, const Body& body)
+{
+    float3 p = vertices[vi];
+    grid.eachPointInBox(p - npEpsilon, p + npEpsilon, [&](int i) {
+        if (i != vi && length(vertices[i] - p) < npEpsilon) {
+            body(i);
         }
-        average = normalize(average);
-        normals[vi] = normalize(normals[vi] + average * (strength * s));
     });
 }
 
@@ -695,42 +735,104 @@ npAPI int npWeld(
     auto normals = model->normals;
     auto selection = model->selection;
 
-    RawVector<bool> checked;
-    checked.resize(num_vertices);
-    checked.zeroclear();
+    auto cache = npGetModelCache(*model);
+    auto& grid = cache->getPointGrid();
 
-    int ret = 0;
-    RawVector<int> shared;
+    // welding affects only vertices connected by coincident pairs. split vertices into such groups.
+    RawVector<int> has_pair;
+    has_pair.resize_zeroclear(num_vertices);
+    parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
+        for (; vi < vend; ++vi) {
+            EachCoincidentVertex(grid, vertices, vi, [&](int) { has_pair[vi] = 1; });
+        }
+    });
+
+    RawVector<int> parent;
+    parent.resize_discard(num_vertices);
     for (int vi = 0; vi < num_vertices; ++vi) {
-        if (checked[vi]) { continue; }
-        float s = mask ? selection[vi] : 1.0f;
-        if (s == 0.0f) { continue; }
-
-        float3 p = vertices[vi];
-        float3 n = normals[vi];
-        for (int i = 0; i < num_vertices; ++i) {
-            if (vi != i && !checked[i] &&
-                length(vertices[i] - p) < npEpsilon &&
-                angle_between(n, normals[i]) * Rad2Deg <= weld_angle)
-            {
-                if (smoothing) n += normals[i];
-                shared.push_back(i);
-                checked[i] = true;
-            }
+        parent[vi] = vi;
+    }
+    auto find_root = [&](int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
         }
+        return i;
+    };
 
-        if (!shared.empty()) {
-            n = normalize(n);
-            normals[vi] = n;
-            for (int si : shared) {
-                normals[si] = n;
+    struct Member { int root, vi; };
+    RawVector<Member> members;
+    for (int vi = 0; vi < num_vertices; ++vi) {
+        if (!has_pair[vi]) { continue; }
+        EachCoincidentVertex(grid, vertices, vi, [&](int i) {
+            int r1 = find_root(vi), r2 = find_root(i);
+            if (r1 != r2) {
+                parent[std::max<int>(r1, r2)] = std::min<int>(r1, r2);
             }
-            shared.clear();
-            ++ret;
+        });
+    }
+    for (int vi = 0; vi < num_vertices; ++vi) {
+        if (has_pair[vi]) {
+            members.push_back({ find_root(vi), vi });
         }
     }
+    std::sort(members.begin(), members.end(), [](const Member& a, const Member& b) {
+        return a.root < b.root || (a.root == b.root && a.vi < b.vi);
+    });
 
-    return ret;
+    RawVector<int> group_offsets;
+    for (int mi = 0; mi < (int)members.size(); ++mi) {
+        if (mi == 0 || members[mi].root != members[mi - 1].root) {
+            group_offsets.push_back(mi);
+        }
+    }
+    group_offsets.push_back((int)members.size());
+
+    // vertices of each group are processed in index order, in the same way as comparing all vertices.
+    RawVector<bool> checked;
+    checked.resize(num_vertices);
+    checked.zeroclear();
+
+    // most groups are just a few vertices. blocks of groups keep per-task overhead low.
+    return parallel_reduce(0, (int)group_offsets.size() - 1, 256, 0, [&](int gi, int gi_end) {
+        RawVector<int> shared;
+        int c = 0;
+        for (; gi < gi_end; ++gi) {
+            int gbegin = group_offsets[gi];
+            int gend = group_offsets[gi + 1];
+            for (int gvi = gbegin; gvi < gend; ++gvi) {
+                int vi = members[gvi].vi;
+                if (checked[vi]) { continue; }
+                float s = mask ? selection[vi] : 1.0f;
+                if (s == 0.0f) { continue; }
+
+                float3 p = vertices[vi];
+                float3 n = normals[vi];
+                for (int gi2 = gbegin; gi2 < gend; ++gi2) {
+                    int i = members[gi2].vi;
+                    if (vi != i && !checked[i] &&
+                        length(vertices[i] - p) < npEpsilon &&
+                        angle_between(n, normals[i]) * Rad2Deg <= weld_angle)
+                    {
+                        if (smoothing) n += normals[i];
+                        shared.push_back(i);
+                        checked[i] = true;
+                    }
+                }
+
+                if (!shared.empty()) {
+                    n = normalize(n);
+                    normals[vi] = n;
+                    for (int si : shared) {
+                        normals[si] = n;
+                    }
+                    shared.clear();
+                    ++c;
+                }
+            }
+        }
+        return c;
+    }, std::plus<int>());
 }
 
 
@@ -748,57 +850,97 @@ npAPI int npWeld2(
 
     RawVector<float4x4> titrans;
     RawVector<float3> wvertices, wnormals;
-    std::vector<RawVector<float3>> twvertices, twnormals;
+    RawVector<float3> twvertices; // world space vertices of all targets
+    RawVector<int> twoffsets;
+    std::vector<RawVector<float3>> twnormals;
 
     // generate world space vertices
     wvertices.resize(num_vertices);
     wnormals.resize(num_vertices);
-    for (int vi = 0; vi < num_vertices; ++vi) {
-        wvertices[vi] = mul_p(trans, vertices[vi]);
-        wnormals[vi] = mul_v(trans, normals[vi]);
-    }
+    parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
+        for (; vi < vend; ++vi) {
+            wvertices[vi] = mul_p(trans, vertices[vi]);
+            wnormals[vi] = mul_v(trans, normals[vi]);
+        }
+    });
 
     titrans.resize(num_targets);
-    twvertices.resize(num_targets);
+    twoffsets.resize(num_targets + 1);
     twnormals.resize(num_targets);
+    twoffsets[0] = 0;
+    for (int ti = 0; ti < num_targets; ++ti) {
+        twoffsets[ti + 1] = twoffsets[ti] + targets[ti].num_vertices;
+    }
+    twvertices.resize(twoffsets[num_targets]);
     for (int ti = 0; ti < num_targets; ++ti) {
         auto tt = targets[ti].transform;
         titrans[ti] = invert(tt);
 
         auto tva = targets[ti].vertices;
         auto tna = targets[ti].normals;
-        auto& twva = twvertices[ti];
+        auto twva = twvertices.data() + twoffsets[ti];
         auto& twna = twnormals[ti];
         int num_tv = targets[ti].num_vertices;
-        twva.resize(num_tv);
         twna.resize(num_tv);
-        for (int tvi = 0; tvi < num_tv; ++tvi) {
-            twva[tvi] = mul_p(tt, tva[tvi]);
-            twna[tvi] = mul_v(tt, tna[tvi]);
-        }
+        parallel_for_blocked(0, num_tv, npVertexBlockSize, [&](int tvi, int tvend) {
+            for (; tvi < tvend; ++tvi) {
+                twva[tvi] = mul_p(tt, tva[tvi]);
+                twna[tvi] = mul_v(tt, tna[tvi]);
+            }
+        });
     }
 
-    std::vector<RawVector<std::pair<int, int>>> weld_maps;
-    weld_maps.resize(num_targets);
-
-    // generate weld maps
-    for (int ti = 0; ti < num_targets; ++ti) {
-        auto& weld_map = weld_maps[ti];
-
-        for (int vi = 0; vi < num_vertices; ++vi) {
+    // find target vertices for each model vertex. match_indices are indices in twvertices.
+    PointGrid grid;
+    grid.build(twvertices.data(), (int)twvertices.size());
+
+    RawVector<int> match_counts, match_offsets, match_indices;
+    match_counts.resize_zeroclear(num_vertices);
+    // returns number of matches. also stores them to dst if it is not null.
+    auto find_matches = [&](int vi, int *dst) -> int {
+        auto p = wvertices[vi];
+        auto n = wnormals[vi];
+        int num_matches = 0;
+        grid.eachPointInBox(p - npEpsilon, p + npEpsilon, [&](int twi) {
+            int ti = int(std::upper_bound(twoffsets.begin(), twoffsets.end(), twi) - twoffsets.begin()) - 1;
+            int tvi = twi - twoffsets[ti];
+            if (length(twvertices[twi] - p) < npEpsilon && angle_between(n, twnormals[ti][tvi]) * Rad2Deg <= weld_angle) {
+                if (dst) { dst[num_matches] = twi; }
+                ++num_matches;
+            }
+        });
+        return num_matches;
+    };
+    parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
+        for (; vi < vend; ++vi) {
             float s = mask ? selection[vi] : 1.0f;
             if (s == 0.0f) { continue; }
+            match_counts[vi] = find_matches(vi, nullptr);
+        }
+    });
 
-            auto p = wvertices[vi];
-            auto n = wnormals[vi];
-            auto& twva = twvertices[ti];
-            auto& twna = twnormals[ti];
-            int num_tv = targets[ti].num_vertices;
-            for (int tvi = 0; tvi < num_tv; ++tvi) {
-                if (length(twva[tvi] - p) < npEpsilon && angle_between(n, twna[tvi]) * Rad2Deg <= weld_angle) {
-                    weld_map.push_back({ vi, tvi });
-                }
-            }
+    match_offsets.resize(num_vertices + 1);
+    match_offsets[0] = 0;
+    for (int vi = 0; vi < num_vertices; ++vi) {
+        match_offsets[vi + 1] = match_offsets[vi] + match_counts[vi];
+    }
+    match_indices.resize(match_offsets[num_vertices]);
+    parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int vi, int vend) {
+        for (; vi < vend; ++vi) {
+            if (match_counts[vi] == 0) { continue; }
+            int *dst = match_indices.data() + match_offsets[vi];
+            std::sort(dst, dst + find_matches(vi, dst));
+        }
+    });
+
+    // generate weld maps. the order is the same as comparing all pairs target by target.
+    std::vector<RawVector<std::pair<int, int>>> weld_maps;
+    weld_maps.resize(num_targets);
+    for (int vi = 0; vi < num_vertices; ++vi) {
+        for (int mi = match_offsets[vi]; mi < match_offsets[vi + 1]; ++mi) {
+            int twi = match_indices[mi];
+            int ti = int(std::upper_bound(twoffsets.begin(), twoffsets.end(), twi) - twoffsets.begin()) - 1;
+            weld_maps[ti].push_back({ vi, twi - twoffsets[ti] });
         }
     }
 
@@ -997,16 +1139,14 @@ inline int BrushProjectionImpl(
     auto normals = model->normals;
     auto selection = model->selection;
 
-    auto pnum_triangles = normal_source->num_triangles;
     auto pnormals = normal_source->normals;
     auto pindices = normal_source->indices;
 
+    // transformed vertices and BVH are kept across stamps
     auto to_local = normal_source->transform * invert(model->transform);
-    RawVector<float3> pvertices;
-    pvertices.resize(normal_source->num_vertices);
-    for (int vi = 0; vi < normal_source->num_vertices; ++vi) {
-        pvertices[vi] = mul_p(to_local, normal_source->vertices[vi]);
-    }
+    auto pcache = npGetModelCache(*normal_source);
+    auto& pbvh = pcache->getTransformedBVH(to_local);
+    auto pvertices = pbvh.vertices;
 
     auto sign = strength < 0.0f ? -1.0f : 1.0f;
 
@@ -1018,7 +1158,7 @@ inline int BrushProjectionImpl(
         float3 rdir = ray_dirs[vi];
         int ti;
         float distance;
-        int num_hit = RayTrianglesIntersectionIndexed(rpos, rdir, pvertices.data(), pindices, pnum_triangles, ti, distance);
+        int num_hit = pbvh.raycast(rpos, rdir, ti, distance);
 
         if (num_hit > 0) {
             float3 result = triangle_interpolation(
@@ -1058,42 +1198,56 @@ npAPI int npBrushProjection2(
 }
 
 
-npAPI int npBuildMirroringRelation(
-    npMeshData *model, float3 plane_normal, float epsilon, int relation[])
+// relations: num_planes * num_vertices. relations[pi * num_vertices + vi] is the relation of plane pi.
+npAPI int npBuildMirroringRelations(
+    npMeshData *model, const float3 plane_normals[], int num_planes, float epsilon, int relations[])
 {
     auto num_vertices = model->num_vertices;
     auto vertices = model->vertices;
     auto normals = model->normals;
 
-    RawVector<float> distances;
-    distances.resize(num_vertices);
-    parallel_for(0, num_vertices, [&](int vi) {
-        distances[vi] = plane_distance(vertices[vi], plane_normal);
-    });
+    auto cache = npGetModelCache(*model);
+    auto& grid = cache->getPointGrid();
 
-    std::atomic_int ret{ 0 };
-    parallel_for(0, num_vertices, [&](int vi) {
-        int rel = -1;
-        float d1 = distances[vi];
-        if (d1 < 0.0f) {
-            for (int i = 0; i < num_vertices; ++i) {
-                float d2 = distances[i];
-                if (d2 > 0.0f &&
-                    length(vertices[vi] - (vertices[i] - plane_normal * (d2 * 2.0f))) < npEpsilon)
-                {
-                    float3 n1 = normals[vi];
-                    float3 n2 = plane_mirror(normals[i], plane_normal);
-                    if (dot(n1, n2) >= 0.99f) {
-                        rel = i;
-                        ++ret;
-                        break;
-                    }
+    return parallel_reduce(0, num_vertices, npVertexBlockSize, 0, [&](int vi, int vend) {
+        int c = 0;
+        for (; vi < vend; ++vi) {
+            for (int pi = 0; pi < num_planes; ++pi) {
+                auto plane_normal = plane_normals[pi];
+                int rel = -1;
+                float d1 = plane_distance(vertices[vi], plane_normal);
+                if (d1 < 0.0f) {
+                    // search around mirrored position. the box is padded for rounding errors of mirroring.
+                    // the smallest index that passes the test is the relation.
+                    float3 mp = plane_mirror(vertices[vi], plane_normal);
+                    float pad = npEpsilon + length(mp) * 1e-5f;
+                    grid.eachPointInBox(mp - pad, mp + pad, [&](int i) {
+                        if (rel != -1 && i > rel) { return; }
+
+                        float d2 = plane_distance(vertices[i], plane_normal);
+                        if (d2 > 0.0f &&
+                            length(vertices[vi] - (vertices[i] - plane_normal * (d2 * 2.0f))) < npEpsilon)
+                        {
+                            float3 n1 = normals[vi];
+                            float3 n2 = plane_mirror(normals[i], plane_normal);
+                            if (dot(n1, n2) >= 0.99f) {
+                                rel = i;
+                            }
+                        }
+                    });
+                    if (rel != -1) { ++c; }
                 }
+                relations[pi * num_vertices + vi] = rel;
             }
         }
-        relation[vi] = rel;
-    });
-    return ret;
+        return c;
+    }, std::plus<int>());
+}
+
+npAPI int npBuildMirroringRelation(
+    npMeshData *model, float3 plane_normal, float epsilon, int relation[])
+{
+    return npBuildMirroringRelations(model, &plane_normal, 1, epsilon, relation);
 }
 
 npAPI void npApplyMirroring(int num_vertices, const int relation[], float3 plane_normal, float3 normals[])
@@ -1106,6 +1260,44 @@ npAPI void npApplyMirroring(int num_vertices, const int relation[], float3 plane
 }
 
 
+// spreads lower 10 bits of v to every 3rd bit
+static inline uint32_t SpreadBits3(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+struct MortonRay { uint32_t code; int vi; };
+
+// stable LSD radix sort of 30 bit Morton codes, 10 bits per pass. O(n) unlike std::sort.
+static void SortByMortonCode(RawVector<MortonRay>& rays)
+{
+    const int num_buckets = 1 << 10;
+    int num_rays = (int)rays.size();
+    RawVector<MortonRay> tmp;
+    tmp.resize_discard(num_rays);
+    for (int shift = 0; shift < 30; shift += 10) {
+        int offsets[num_buckets] = {};
+        for (int ri = 0; ri < num_rays; ++ri) {
+            ++offsets[(rays[ri].code >> shift) & (num_buckets - 1)];
+        }
+        int offset = 0;
+        for (int bi = 0; bi < num_buckets; ++bi) {
+            int c = offsets[bi];
+            offsets[bi] = offset;
+            offset += c;
+        }
+        for (int ri = 0; ri < num_rays; ++ri) {
+            tmp[offsets[(rays[ri].code >> shift) & (num_buckets - 1)]++] = rays[ri];
+        }
+        rays.swap(tmp);
+    }
+}
+
 template<class RayDirs>
 inline void ProjectNormalsImpl(
     npMeshData *model, npMeshData *target, const RayDirs& ray_dirs, int mask)
@@ -1115,49 +1307,52 @@ inline void ProjectNormalsImpl(
     auto normals = model->normals;
     auto selection = model->selection;
 
-    auto pnum_triangles = target->num_triangles;
-    auto pvertices = target->vertices;
     auto pnormals = target->normals;
     auto pindices = target->indices;
 
     auto to_local = target->transform * invert(model->transform);
-    RawVector<float> soa[9]; // flattened + SoA-nized vertices (faster on CPU)
+    auto pcache = npGetModelCache(*target);
+    auto& pbvh = pcache->getTransformedBVH(to_local);
+    auto pvertices = pbvh.vertices;
+    if (pbvh.empty()) { return; }
 
-                             // flatten + SoA-nize
+    // sort rays by Morton code of their origins so that consecutive rays visit the same BVH nodes
+    RawVector<MortonRay> rays;
     {
-        for (int i = 0; i < 9; ++i) {
-            soa[i].resize(pnum_triangles);
-        }
-        for (int ti = 0; ti < pnum_triangles; ++ti) {
-            for (int i = 0; i < 3; ++i) {
-                auto p = mul_p(to_local, pvertices[pindices[ti * 3 + i]]);
-                soa[i * 3 + 0][ti] = p.x;
-                soa[i * 3 + 1][ti] = p.y;
-                soa[i * 3 + 2][ti] = p.z;
-            }
+        float3 bmin, bmax;
+        MinMax(vertices, num_vertices, bmin, bmax);
+        float3 ext = bmax - bmin;
+        float3 scale = {
+            ext.x > 0.0f ? 1023.0f / ext.x : 0.0f,
+            ext.y > 0.0f ? 1023.0f / ext.y : 0.0f,
+            ext.z > 0.0f ? 1023.0f / ext.z : 0.0f };
+        for (int vi = 0; vi < num_vertices; ++vi) {
+            float s = mask ? selection[vi] : 1.0f;
+            if (s == 0.0f) { continue; }
+
+            float3 c = (vertices[vi] - bmin) * scale;
+            uint32_t code = (SpreadBits3((uint32_t)c.x) << 2) | (SpreadBits3((uint32_t)c.y) << 1) | SpreadBits3((uint32_t)c.z);
+            rays.push_back({ code, vi });
         }
+        // the sort is stable and rays are added in vertex order, so rays with the same code stay in vertex order
+        SortByMortonCode(rays);
     }
 
-    parallel_for(0, num_vertices, [&](int vi) {
-        float s = mask ? selection[vi] : 1.0f;
-        if (s == 0.0f) { return; }
-
-        float3 rpos = vertices[vi];
-        float3 rdir = ray_dirs[vi];
-        int ti;
-        float distance;
-        int num_hit = RayTrianglesIntersectionSoA(rpos, rdir,
-            soa[0].data(), soa[1].data(), soa[2].data(),
-            soa[3].data(), soa[4].data(), soa[5].data(),
-            soa[6].data(), soa[7].data(), soa[8].data(),
-            pnum_triangles, ti, distance);
+    parallel_for_blocked(0, (int)rays.size(), 256, [&](int begin, int end) {
+        for (int ri = begin; ri < end; ++ri) {
+            int vi = rays[ri].vi;
+            float3 rpos = vertices[vi];
+            float3 rdir = ray_dirs[vi];
+            int ti = -1;
+            float distance = 0.0f;
+            if (pbvh.raycast(rpos, rdir, ti, distance) == 0) { continue; }
 
-        if (num_hit > 0) {
+            float s = mask ? selection[vi] : 1.0f;
             float3 result = triangle_interpolation(
                 rpos + rdir * distance,
-                { soa[0][ti], soa[1][ti], soa[2][ti] },
-                { soa[3][ti], soa[4][ti], soa[5][ti] },
-                { soa[6][ti], soa[7][ti], soa[8][ti] },
+                pvertices[pindices[ti * 3 + 0]],
+                pvertices[pindices[ti * 3 + 1]],
+                pvertices[pindices[ti * 3 + 2]],
                 pnormals[pindices[ti * 3 + 0]],
                 pnormals[pindices[ti * 3 + 1]],
                 pnormals[pindices[ti * 3 + 2]]);
@@ -1186,90 +1381,15 @@ npAPI void npProjectNormals2(
 
 }
 
-template<int NumInfluence>
-static void SkinningImpl(
-    int num_vertices, const RawVector<float4x4>& poses, const Weights<NumInfluence> weights[],
-    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
-    float3 opoints[], float3 onormals[], float4 otangents[])
-{
-    parallel_invoke(
-    [&]() {
-        if (ipoints && opoints) {
-            for (int vi = 0; vi < num_vertices; ++vi) {
-                const auto& w = weights[vi];
-                float3 p = ipoints[vi];
-                float3 rp = float3::zero();
-                for (int bi = 0; bi < NumInfluence; ++bi) {
-                    rp += mul_p(poses[w.indices[bi]], p) * w.weights[bi];
-                }
-                opoints[vi] = rp;
-            }
-        }
-    },
-    [&]() {
-        if (inormals && onormals) {
-            for (int vi = 0; vi < num_vertices; ++vi) {
-                const auto& w = weights[vi];
-                float3 n = inormals[vi];
-                float3 rn = float3::zero();
-                for (int bi = 0; bi < NumInfluence; ++bi) {
-                    rn += mul_v(poses[w.indices[bi]], n) * w.weights[bi];
-                }
-                onormals[vi] = normalize(rn);
-            }
-        }
-    },
-    [&]() {
-        if (itangents && otangents) {
-            for (int vi = 0; vi < num_vertices; ++vi) {
-                const auto& w = weights[vi];
-                float4 t = itangents[vi];
-                float4 rt = float4::zero();
-                for (int bi = 0; bi < NumInfluence; ++bi) {
-                    rt += mul_v(poses[w.indices[bi]], t) * w.weights[bi];
-                }
-                otangents[vi] = rt;
-            }
-        }
-    });
-}
-
-npAPI void npApplySkinning(
-    npSkinData *skin,
-    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
-    float3 opoints[], float3 onormals[], float4 otangents[])
-{
-    RawVector<float4x4> poses;
-    poses.resize(skin->num_bones);
-
-    auto iroot = invert(skin->root);
-    for (int bi = 0; bi < skin->num_bones; ++bi) {
-        poses[bi] = skin->bindposes[bi] * skin->bones[bi] * iroot;
-    }
-    SkinningImpl(skin->num_vertices, poses, skin->weights, ipoints, inormals, itangents, opoints, onormals, otangents);
-}
-
-npAPI void npApplyReverseSkinning(
-    npSkinData *skin,
-    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
-    float3 opoints[], float3 onormals[], float4 otangents[])
-{
-    RawVector<float4x4> poses;
-    poses.resize(skin->num_bones);
-
-    auto iroot = invert(skin->root);
-    for (int bi = 0; bi < skin->num_bones; ++bi) {
-        poses[bi] = invert(skin->bindposes[bi] * skin->bones[bi] * iroot);
-    }
-    SkinningImpl(skin->num_vertices, poses, skin->weights, ipoints, inormals, itangents, opoints, onormals, otangents);
-}
-
-
 npAPI void npGenerateNormals(npMeshData *model, float3 dst[])
 {
     if (!dst) dst = model->normals;
     if (!dst || !model->vertices || !model->indices) return;
-    GenerateNormalsTriangleIndexed(dst, model->vertices, model->indices, model->num_triangles, model->num_vertices);
+
+    // gather from the cached vertex to face connection. parallel and deterministic
+    int num_vertices = model->num_vertices;
+    GenerateNormalsWithConnection({ dst, (size_t)num_vertices }, { model->vertices, (size_t)num_vertices },
+        { model->indices, (size_t)model->num_triangles * 3 }, 3, npGetModelCache(*model)->getConnection());
 }
 
 npAPI void npGenerateTangents(npMeshData *model, float4 dst[])
@@ -1280,44 +1400,6 @@ npAPI void npGenerateTangents(npMeshData *model, float4 dst[])
         model->vertices, model->uv, model->normals, model->indices, model->num_triangles, model->num_vertices);
 }
 
-npAPI void npGenerateTerrainMesh(
-    const float heightmap[], int width, int height, float3 size,
-    float3 dst_vertices[], float3 dst_normals[], float2 dst_uv[], int dst_indices[])
-{
-    int num_vertices = width * height;
-    int num_triangles = (width - 1) * (height - 1) * 2;
-    auto size_unit = float3{ 1.0f / (width - 1), 1.0f, 1.0f / (height - 1) } *size;
-    auto uv_unit = float2{ 1.0f / (width - 1), 1.0f / (height - 1) };
-
-    parallel_invoke(
-    [&]() {
-        for (int iy = 0; iy < height; ++iy) {
-            for (int ix = 0; ix < width; ++ix) {
-                int i = iy * width + ix;
-                dst_vertices[i] = float3{ (float)ix, heightmap[i], (float)iy } * size_unit;
-                dst_uv[i] = float2{ (float)ix, (float)iy } * uv_unit;
-            }
-        }
-    },
-    [&]() {
-        for (int iy = 0; iy < height - 1; ++iy) {
-            for (int ix = 0; ix < width - 1; ++ix) {
-                int i6 = (iy * width + ix) * 6;
-                dst_indices[i6 + 0] = width*iy + ix;
-                dst_indices[i6 + 1] = width*(iy + 1) + ix;
-                dst_indices[i6 + 2] = width*(iy + 1) + (ix + 1);
-
-                dst_indices[i6 + 3] = width*iy + ix;
-                dst_indices[i6 + 4] = width*(iy + 1) + (ix + 1);
-                dst_indices[i6 + 5] = width*iy + (ix + 1);
-            }
-        }
-    });
-
-    GenerateNormalsTriangleIndexed(dst_normals, dst_vertices, dst_indices, num_triangles, num_vertices);
-}
-
-
 float g_pen_pressure = 1.0f;
 
 npAPI float npGetPenPressure()
@@ -9,3 +9,49 @@
 
 #include "MeshUtils/MeshUtils.h"
 using namespace mu;
+
+// granularity of parallel loops over vertices
+#define npVertexBlockSize 1024
+
+struct npMeshData
+{
+    int         *indices = nullptr;
+    float3      *vertices = nullptr;
+    float3      *normals = nullptr;
+    float4      *tangents = nullptr;
+    float2      *uv = nullptr;
+    float       *selection = nullptr;
+    int         num_vertices = 0;
+    int         num_triangles = 0;
+    float4x4    transform = float4x4::identity();
+};
+
+// same layout as Unity's BoneWeight1
+struct npBoneWeight1
+{
+    float       weight = 0.0f;
+    int         index = 0;
+};
+
+enum npSkinningMethod
+{
+    npSkinningLinear = 0, // linear blend of matrices
+    npSkinningDualQuaternion = 1, // blend of dual quaternions. scale and shear of poses are ignored
+};
+
+struct npSkinData
+{
+    void        *weights = nullptr; // Weights<influences_per_vertex>
+    float4x4    *bones = nullptr;
+    float4x4    *bindposes = nullptr;
+    int         num_vertices = 0;
+    int         num_bones = 0;
+    float4x4    root = float4x4::identity();
+    int         influences_per_vertex = 4; // 1, 2, 4 or 8. 0 is treated as 4.
+
+    // variable number of influences per vertex (layout of Unity's Mesh.GetAllBoneWeights()).
+    // used instead of weights if not null. influences of a vertex follow those of the previous vertex.
+    npBoneWeight1 *weights1 = nullptr;
+    uint8_t     *bones_per_vertex = nullptr;
+    int         skinning_method = npSkinningLinear;
+};
@@ -0,0 +1,590 @@
+#include "pch.h"
+#include <mutex>
+#include "NormalPainter.h"
+#include "npModelCache.h"
+
+#define npMaxModelCaches 16
+// rebuild BVHs whose refitted cost exceeds the cost at build time by this ratio
+#define npBVHRebuildRatio 2.0f
+
+// moved vertices of an existing tree are refitted. rebuilt if it is new or got too bad.
+static void UpdateBVH(TriangleBVH& bvh, const float3 *vertices, const int *indices, int num_triangles)
+{
+    if (!bvh.empty() && bvh.vertices == vertices && bvh.indices == indices && bvh.num_triangles == num_triangles &&
+        bvh.refit() < npBVHRebuildRatio)
+    {
+        return;
+    }
+    bvh.build(vertices, indices, num_triangles);
+}
+
+bool npModelCache::matches(const npMeshData& model) const
+{
+    return m_vertices == model.vertices && m_indices == model.indices &&
+        m_num_vertices == model.num_vertices && m_num_triangles == model.num_triangles;
+}
+
+void npModelCache::reset(const npMeshData& model)
+{
+    m_vertices = model.vertices;
+    m_indices = model.indices;
+    m_num_vertices = model.num_vertices;
+    m_num_triangles = model.num_triangles;
+    m_bvh.clear();
+    m_bvh_dirty = true;
+    m_grid.clear();
+    m_grid_dirty = true;
+    m_tvertices.clear();
+    m_tvertices_dirty = true;
+    m_tbvh.clear();
+    m_tbvh_dirty = true;
+    m_connection.clear();
+    m_connection_dirty = true;
+    m_wconnection.clear();
+    m_wconnection_dirty = true;
+    m_selection = nullptr;
+    m_selected.clear();
+    m_selected_weights.clear();
+    m_selected_dirty = true;
+    m_selection_sums_dirty = true;
+}
+
+void npModelCache::markPointsDirty(bool refit)
+{
+    // m_connection depends only on indices
+    m_bvh_dirty = true;
+    m_grid_dirty = true;
+    m_tvertices_dirty = true;
+    m_tbvh_dirty = true;
+    m_wconnection_dirty = true;
+    m_selection_sums_dirty = true;
+
+    if (refit && !m_bvh.empty()) {
+        getBVH();
+    }
+}
+
+const TriangleBVH& npModelCache::getBVH()
+{
+    if (m_bvh_dirty) {
+        UpdateBVH(m_bvh, m_vertices, m_indices, m_num_triangles);
+        m_bvh_dirty = false;
+    }
+    return m_bvh;
+}
+
+const PointGrid& npModelCache::getPointGrid()
+{
+    if (m_grid_dirty) {
+        m_grid.build(m_vertices, m_num_vertices);
+        m_grid_dirty = false;
+    }
+    return m_grid;
+}
+
+const RawVector<float3>& npModelCache::getTransformedVertices(const float4x4& trans)
+{
+    if (m_tvertices_dirty || trans != m_ttrans) {
+        m_ttrans = trans;
+        m_tvertices.resize_discard(m_num_vertices);
+        parallel_for_blocked(0, m_num_vertices, 1024, [&](int vi, int vend) {
+            for (; vi < vend; ++vi) {
+                m_tvertices[vi] = mul_p(trans, m_vertices[vi]);
+            }
+        });
+        m_tvertices_dirty = false;
+        m_tbvh_dirty = true;
+    }
+    return m_tvertices;
+}
+
+const TriangleBVH& npModelCache::getTransformedBVH(const float4x4& trans)
+{
+    auto& tvertices = getTransformedVertices(trans);
+    if (m_tbvh_dirty) {
+        // a transformed tree is refitted too. rigid transforms keep its quality.
+        UpdateBVH(m_tbvh, tvertices.data(), m_indices, m_num_triangles);
+        m_tbvh_dirty = false;
+    }
+    return m_tbvh;
+}
+
+const ConnectionData& npModelCache::getConnection()
+{
+    if (m_connection_dirty) {
+        m_connection.buildConnection({ m_indices, (size_t)m_num_triangles * 3 }, 3, { m_vertices, (size_t)m_num_vertices });
+        m_connection_dirty = false;
+    }
+    return m_connection;
+}
+
+const ConnectionData& npModelCache::getWeldedConnection()
+{
+    if (m_wconnection_dirty) {
+        m_wconnection.buildConnection({ m_indices, (size_t)m_num_triangles * 3 }, 3, { m_vertices, (size_t)m_num_vertices }, true);
+        m_wconnection_dirty = false;
+    }
+    return m_wconnection;
+}
+
+const RawVector<int>& npModelCache::getSelectedIndices(const float *selection)
+{
+    if (m_selected_dirty || selection != m_selection) {
+        m_selection = selection;
+        parallel_compact(0, m_num_vertices, 1024, m_selected, [&](int vi) {
+            return selection[vi] > 0.0f;
+        });
+        m_selected_weights.resize_discard(m_selected.size());
+        parallel_for_blocked(0, (int)m_selected.size(), 1024, [&](int si, int send) {
+            for (; si < send; ++si) {
+                m_selected_weights[si] = selection[m_selected[si]];
+            }
+        });
+        m_selected_dirty = false;
+        m_selection_sums_dirty = true;
+    }
+    return m_selected;
+}
+
+void npModelCache::updateSelectedIndices(const float *selection, const int *changed, int num_changed, bool cleared)
+{
+    if (m_selected_dirty || selection != m_selection) {
+        // the whole selection is scanned anyway
+        getSelectedIndices(selection);
+        return;
+    }
+    if (cleared) {
+        m_selected.clear();
+        m_selected_weights.clear();
+        m_selection_weight = 0.0;
+        m_selection_pos = double3::zero();
+    }
+
+    RawVector<int> tmp;
+    tmp.assign(changed, changed + num_changed);
+    std::sort(tmp.begin(), tmp.end());
+    tmp.erase(std::unique(tmp.begin(), tmp.end()), tmp.end());
+
+    // merge sorted lists. changed vertices are included only if they are still selected,
+    // and the sums are updated by the difference of their weights.
+    RawVector<int> merged;
+    RawVector<float> merged_weights;
+    merged.reserve(m_selected.size() + tmp.size());
+    merged_weights.reserve(m_selected.size() + tmp.size());
+    size_t si = 0, ci = 0;
+    while (si < m_selected.size() || ci < tmp.size()) {
+        if (ci == tmp.size() || (si < m_selected.size() && m_selected[si] < tmp[ci])) {
+            merged.push_back(m_selected[si]);
+            merged_weights.push_back(m_selected_weights[si]);
+            ++si;
+        }
+        else {
+            int vi = tmp[ci++];
+            float prev = 0.0f;
+            if (si < m_selected.size() && m_selected[si] == vi) {
+                prev = m_selected_weights[si++];
+            }
+            float s = selection[vi];
+            if (s > 0.0f) {
+                merged.push_back(vi);
+                merged_weights.push_back(s);
+            }
+            else {
+                s = 0.0f;
+            }
+
+            if (!m_selection_sums_dirty && s != prev) {
+                double3 p;
+                p.assign(m_vertices[vi]);
+                double d = (double)s - (double)prev;
+                m_selection_weight += d;
+                m_selection_pos += p * d;
+            }
+        }
+    }
+    m_selected.swap(merged);
+    m_selected_weights.swap(merged_weights);
+
+    if (m_selected.empty()) {
+        // don't leave rounding errors
+        m_selection_weight = 0.0;
+        m_selection_pos = double3::zero();
+    }
+}
+
+void npModelCache::markSelectionDirty()
+{
+    m_selected_dirty = true;
+}
+
+void npModelCache::getSelectionSums(const float *selection, double& weight, double3& pos)
+{
+    getSelectedIndices(selection);
+    if (m_selection_sums_dirty) {
+        struct Sums { double weight; double3 pos; };
+        auto sums = parallel_reduce(0, (int)m_selected.size(), 1024, Sums{ 0.0, double3::zero() },
+            [&](int si, int send) {
+                Sums r{ 0.0, double3::zero() };
+                for (; si < send; ++si) {
+                    double3 p;
+                    p.assign(m_vertices[m_selected[si]]);
+                    double s = m_selected_weights[si];
+                    r.weight += s;
+                    r.pos += p * s;
+                }
+                return r;
+            },
+            [](const Sums& a, const Sums& b) { return Sums{ a.weight + b.weight, a.pos + b.pos }; });
+        m_selection_weight = sums.weight;
+        m_selection_pos = sums.pos;
+        m_selection_sums_dirty = false;
+    }
+    weight = m_selection_weight;
+    pos = m_selection_pos;
+}
+
+
+// caches are looked up by the vertex buffer. the most recently used one is at the back.
+static std::mutex g_caches_mutex;
+static std::vector<npModelCachePtr> g_caches;
+static std::vector<npModel*> g_models;
+
+npModelCachePtr npGetModelCache(const npMeshData& model)
+{
+    std::unique_lock<std::mutex> lock(g_caches_mutex);
+
+    for (auto *m : g_models) {
+        if (m->cache->matches(model)) {
+            return m->cache;
+        }
+    }
+
+    npModelCachePtr ret;
+    auto it = std::find_if(g_caches.begin(), g_caches.end(),
+        [&](const npModelCachePtr& c) { return c->matches(model); });
+    if (it != g_caches.end()) {
+        ret = *it;
+        g_caches.erase(it);
+    }
+    else {
+        // an entry with the same vertex buffer but different topology is stale
+        g_caches.erase(std::remove_if(g_caches.begin(), g_caches.end(),
+            [&](const npModelCachePtr& c) { return c->getVertices() == model.vertices; }), g_caches.end());
+
+        ret = std::make_shared<npModelCache>();
+        ret->reset(model);
+        if (g_caches.size() >= npMaxModelCaches) {
+            g_caches.erase(g_caches.begin());
+        }
+    }
+    g_caches.push_back(ret);
+    // nobody notifies these caches of selection changes made by the caller. don't reuse the index across calls.
+    ret->markSelectionDirty();
+    return ret;
+}
+
+void npMarkPointsDirty(const float3 *vertices, bool refit)
+{
+    if (!vertices) { return; }
+
+    std::unique_lock<std::mutex> lock(g_caches_mutex);
+    for (auto *m : g_models) {
+        if (m->cache->getVertices() == vertices) {
+            m->cache->markPointsDirty(refit);
+        }
+    }
+    for (auto& c : g_caches) {
+        if (c->getVertices() == vertices) {
+            c->markPointsDirty(refit);
+        }
+    }
+}
+
+
+
+// 0 is treated as 4 so that zero-initialized npSkinData from older callers keep working.
+static inline int GetInfluencesPerVertex(const npSkinData& skin)
+{
+    return skin.influences_per_vertex > 0 ? skin.influences_per_vertex : 4;
+}
+
+bool npSkinCache::matches(const npSkinData& skin) const
+{
+    return m_weights == skin.weights && m_weights1 == skin.weights1 && m_bones_per_vertex == skin.bones_per_vertex &&
+        m_influences_per_vertex == GetInfluencesPerVertex(skin) && m_skinning_method == skin.skinning_method &&
+        m_num_vertices == skin.num_vertices && m_num_bones == skin.num_bones;
+}
+
+void npSkinCache::reset(const npSkinData& skin)
+{
+    m_weights = skin.weights;
+    m_influences_per_vertex = GetInfluencesPerVertex(skin);
+    m_weights1 = skin.weights1;
+    m_bones_per_vertex = skin.bones_per_vertex;
+    m_skinning_method = skin.skinning_method;
+    m_num_vertices = skin.num_vertices;
+    m_num_bones = skin.num_bones;
+    m_weight_offsets.clear();
+    m_weight_offsets_dirty = true;
+    m_bone_offsets.clear();
+    m_bone_vertices.clear();
+    m_bone_index_dirty = true;
+    m_bones.clear();
+    m_bindposes.clear();
+    m_poses.clear();
+    m_iposes.clear();
+    m_dqs.clear();
+    m_poses_dirty = true;
+}
+
+const RawVector<int>& npSkinCache::getWeightOffsets()
+{
+    if (m_weight_offsets_dirty) {
+        m_weight_offsets.resize_discard(m_num_vertices + 1);
+        if (m_bones_per_vertex) {
+            auto *offsets = m_weight_offsets.data();
+            parallel_for_blocked(0, m_num_vertices, 4096, [&](int vi, int vend) {
+                for (; vi < vend; ++vi) { offsets[vi] = m_bones_per_vertex[vi]; }
+            });
+            offsets[m_num_vertices] = parallel_scan(offsets, offsets, m_num_vertices, 4096);
+        }
+        else {
+            m_weight_offsets.zeroclear();
+        }
+        m_weight_offsets_dirty = false;
+    }
+    return m_weight_offsets;
+}
+
+template<int N>
+static inline int GetInfluencingBonesImpl(const Weights<N>& w, int num_bones, int *dst)
+{
+    int n = 0;
+    for (int ii = 0; ii < N; ++ii) {
+        int bi = w.indices[ii];
+        if (w.weights[ii] == 0.0f || bi < 0 || bi >= num_bones) { continue; }
+        if (std::find(dst, dst + n, bi) == dst + n) {
+            dst[n++] = bi;
+        }
+    }
+    return n;
+}
+
+static inline int GetInfluencingBonesImpl(const npBoneWeight1 *w, int num_influences, int num_bones, int *dst)
+{
+    int n = 0;
+    for (int ii = 0; ii < num_influences; ++ii) {
+        int bi = w[ii].index;
+        if (w[ii].weight == 0.0f || bi < 0 || bi >= num_bones) { continue; }
+        if (std::find(dst, dst + n, bi) == dst + n) {
+            dst[n++] = bi;
+        }
+    }
+    return n;
+}
+
+// dst must have room for 255 (max of bones_per_vertex) elements
+int npSkinCache::getInfluencingBones(int vi, int *dst)
+{
+    if (m_bones_per_vertex) {
+        return GetInfluencingBonesImpl(m_weights1 + m_weight_offsets[vi], m_bones_per_vertex[vi], m_num_bones, dst);
+    }
+    switch (m_influences_per_vertex) {
+    case 1: return GetInfluencingBonesImpl(((const Weights<1>*)m_weights)[vi], m_num_bones, dst);
+    case 2: return GetInfluencingBonesImpl(((const Weights<2>*)m_weights)[vi], m_num_bones, dst);
+    case 8: return GetInfluencingBonesImpl(((const Weights<8>*)m_weights)[vi], m_num_bones, dst);
+    default: return GetInfluencingBonesImpl(((const Weights<4>*)m_weights)[vi], m_num_bones, dst);
+    }
+}
+
+void npSkinCache::buildBoneIndex()
+{
+    if (m_bones_per_vertex) {
+        getWeightOffsets();
+    }
+
+    // counting sort of (bone, vertex) pairs by bone. vertices of each bone keep ascending order.
+    int bones[256];
+    m_bone_offsets.resize_zeroclear(m_num_bones + 1);
+    for (int vi = 0; vi < m_num_vertices; ++vi) {
+        int n = getInfluencingBones(vi, bones);
+        for (int i = 0; i < n; ++i) {
+            ++m_bone_offsets[bones[i] + 1];
+        }
+    }
+    for (int bi = 0; bi < m_num_bones; ++bi) {
+        m_bone_offsets[bi + 1] += m_bone_offsets[bi];
+    }
+
+    RawVector<int> cursor;
+    cursor.assign(m_bone_offsets.begin(), m_bone_offsets.end() - 1);
+    m_bone_vertices.resize_discard(m_bone_offsets.back());
+    for (int vi = 0; vi < m_num_vertices; ++vi) {
+        int n = getInfluencingBones(vi, bones);
+        for (int i = 0; i < n; ++i) {
+            m_bone_vertices[cursor[bones[i]]++] = vi;
+        }
+    }
+    m_bone_index_dirty = false;
+}
+
+void npSkinCache::getInfluencedVertices(const int bones[], int num_bones, RawVector<int>& dst)
+{
+    if (m_bone_index_dirty) {
+        buildBoneIndex();
+    }
+
+    dst.clear();
+    const int *bone_vertices = m_bone_vertices.data();
+    for (int i = 0; i < num_bones; ++i) {
+        int bi = bones[i];
+        if (bi < 0 || bi >= m_num_bones) { continue; }
+        // lists of each bone are sorted. merge them.
+        size_t mid = dst.size();
+        dst.insert(dst.end(), bone_vertices + m_bone_offsets[bi], bone_vertices + m_bone_offsets[bi + 1]);
+        std::inplace_merge(dst.begin(), dst.begin() + mid, dst.end());
+    }
+    dst.erase(std::unique(dst.begin(), dst.end()), dst.end());
+}
+
+// rotation and translation of m. columns are normalized so that scale is removed.
+static inline npDualQuat ToDualQuat(const float4x4& m)
+{
+    float3x3 r = { {
+        normalize((const float3&)m[0]),
+        normalize((const float3&)m[1]),
+        normalize((const float3&)m[2]),
+    } };
+    auto& t = (const float3&)m[3];
+    npDualQuat ret;
+    ret.real = to_quat(transpose(r));
+    ret.dual = quatf{ t.x, t.y, t.z, 0.0f } * ret.real * 0.5f;
+    return ret;
+}
+
+void npSkinCache::updatePoses(const npSkinData& skin)
+{
+    int num_bones = m_num_bones;
+    bool all = m_poses_dirty || skin.root != m_root;
+    if (all) {
+        m_root = skin.root;
+        m_bones.assign(skin.bones, skin.bones + num_bones);
+        m_bindposes.assign(skin.bindposes, skin.bindposes + num_bones);
+        m_poses.resize_discard(num_bones);
+        m_iposes.resize_discard(num_bones);
+        if (m_skinning_method == npSkinningDualQuaternion) {
+            m_dqs.resize_discard(num_bones);
+        }
+        m_poses_dirty = false;
+    }
+
+    auto iroot = invert(m_root);
+    for (int bi = 0; bi < num_bones; ++bi) {
+        if (!all) {
+            if (skin.bones[bi] == m_bones[bi] && skin.bindposes[bi] == m_bindposes[bi]) { continue; }
+            m_bones[bi] = skin.bones[bi];
+            m_bindposes[bi] = skin.bindposes[bi];
+        }
+        m_poses[bi] = m_bindposes[bi] * m_bones[bi] * iroot;
+        m_iposes[bi] = invert(m_poses[bi]);
+        if (m_skinning_method == npSkinningDualQuaternion) {
+            m_dqs[bi] = ToDualQuat(m_poses[bi]);
+        }
+    }
+}
+
+const RawVector<float4x4>& npSkinCache::getPoses(const npSkinData& skin)
+{
+    updatePoses(skin);
+    return m_poses;
+}
+
+const RawVector<float4x4>& npSkinCache::getInversePoses(const npSkinData& skin)
+{
+    updatePoses(skin);
+    return m_iposes;
+}
+
+const RawVector<npDualQuat>& npSkinCache::getDualQuaternions(const npSkinData& skin)
+{
+    updatePoses(skin);
+    return m_dqs;
+}
+
+static std::vector<npSkinCachePtr> g_skin_caches;
+
+npSkinCachePtr npGetSkinCache(const npSkinData& skin)
+{
+    std::unique_lock<std::mutex> lock(g_caches_mutex);
+
+    npSkinCachePtr ret;
+    auto it = std::find_if(g_skin_caches.begin(), g_skin_caches.end(),
+        [&](const npSkinCachePtr& c) { return c->matches(skin); });
+    if (it != g_skin_caches.end()) {
+        ret = *it;
+        g_skin_caches.erase(it);
+    }
+    else {
+        ret = std::make_shared<npSkinCache>();
+        ret->reset(skin);
+        if (g_skin_caches.size() >= npMaxModelCaches) {
+            g_skin_caches.erase(g_skin_caches.begin());
+        }
+    }
+    g_skin_caches.push_back(ret);
+    return ret;
+}
+
+
+npAPI npModel* npCreateModel(const npMeshData *data)
+{
+    auto *ret = new npModel();
+    ret->data = *data;
+    ret->cache = std::make_shared<npModelCache>();
+    ret->cache->reset(ret->data);
+
+    std::unique_lock<std::mutex> lock(g_caches_mutex);
+    g_models.push_back(ret);
+    return ret;
+}
+
+npAPI void npUpdateModel(npModel *model, const npMeshData *data)
+{
+    if (!model) { return; }
+
+    std::unique_lock<std::mutex> lock(g_caches_mutex);
+    model->data = *data;
+    // caches that depend on the transform are keyed by it. only new buffers invalidate caches.
+    if (!model->cache->matches(model->data)) {
+        model->cache->reset(model->data);
+    }
+}
+
+npAPI void npMarkModelDirty(npModel *model, int flags)
+{
+    if (!model) { return; }
+
+    std::unique_lock<std::mutex> lock(g_caches_mutex);
+    if (flags & npDirtyTopology) {
+        model->cache->reset(model->data);
+    }
+    else {
+        if (flags & npDirtyPoints) {
+            model->cache->markPointsDirty();
+        }
+        if (flags & npDirtySelection) {
+            model->cache->markSelectionDirty();
+        }
+    }
+}
+
+npAPI void npDestroyModel(npModel *model)
+{
+    if (!model) { return; }
+
+    {
+        std::unique_lock<std::mutex> lock(g_caches_mutex);
+        g_models.erase(std::remove(g_models.begin(), g_models.end(), model), g_models.end());
+    }
+    delete model;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+// derived data of a model (acceleration structures etc).
+// built on first use and kept across API calls as long as the model's buffers are the same.
+class npModelCache
+{
+public:
+    bool matches(const npMeshData& model) const;
+    void reset(const npMeshData& model);
+    // model-space vertices have been modified.
+    // refit: update built BVHs now (e.g. right after skinning) instead of on next use.
+    void markPointsDirty(bool refit = false);
+    const float3* getVertices() const { return m_vertices; }
+
+    const TriangleBVH& getBVH();
+    // model-space vertices
+    const PointGrid& getPointGrid();
+    // vertices transformed by trans (e.g. into world space). updated only when trans or vertices are changed.
+    const RawVector<float3>& getTransformedVertices(const float4x4& trans);
+    // BVH over getTransformedVertices(trans). its 'vertices' are the transformed ones.
+    const TriangleBVH& getTransformedBVH(const float4x4& trans);
+    // vertex to face connection
+    const ConnectionData& getConnection();
+    // connection of welded vertices (vertices at the same position are treated as one)
+    const ConnectionData& getWeldedConnection();
+
+    // vertices with selection > 0 in ascending order.
+    // rebuilt only when the selection is modified by others than npSelect* (see markSelectionDirty()).
+    const RawVector<int>& getSelectedIndices(const float *selection);
+    // selection of 'changed' vertices (any order, duplicates allowed) is modified. others are not.
+    // cleared: selection was zero-cleared before 'changed' are modified.
+    void updateSelectedIndices(const float *selection, const int *changed, int num_changed, bool cleared = false);
+    // selection is modified outside of npSelect* functions.
+    void markSelectionDirty();
+    // sum of selection weights and sum of model-space vertices multiplied by them.
+    // kept up to date by deltas of changed vertices in updateSelectedIndices().
+    void getSelectionSums(const float *selection, double& weight, double3& pos);
+
+private:
+    const float3    *m_vertices = nullptr;
+    const int       *m_indices = nullptr;
+    int             m_num_vertices = 0;
+    int             m_num_triangles = 0;
+
+    TriangleBVH     m_bvh;
+    bool            m_bvh_dirty = true;
+    PointGrid       m_grid;
+    bool            m_grid_dirty = true;
+
+    RawVector<float3> m_tvertices;
+    float4x4        m_ttrans = float4x4::identity();
+    bool            m_tvertices_dirty = true;
+    TriangleBVH     m_tbvh;
+    bool            m_tbvh_dirty = true;
+
+    ConnectionData  m_connection;
+    bool            m_connection_dirty = true;
+    ConnectionData  m_wconnection;
+    bool            m_wconnection_dirty = true;
+
+    const float     *m_selection = nullptr;
+    RawVector<int>  m_selected;
+    RawVector<float> m_selected_weights; // selection of m_selected as of the last update
+    bool            m_selected_dirty = true;
+    double          m_selection_weight = 0.0;
+    double3         m_selection_pos = double3::zero();
+    bool            m_selection_sums_dirty = true;
+};
+using npModelCachePtr = std::shared_ptr<npModelCache>;
+
+// persistent model created by npCreateModel(). its cache is never evicted until npDestroyModel().
+struct npModel
+{
+    npMeshData      data;
+    npModelCachePtr cache;
+};
+
+enum npModelDirtyFlags
+{
+    npDirtyPoints   = 0x1, // positions are modified
+    npDirtyTopology = 0x2, // indices are modified. discards everything
+    npDirtySelection = 0x4, // selection is modified without npSelect* functions
+};
+
+// find or create a cache of the model. caches of npModel are searched first.
+npModelCachePtr npGetModelCache(const npMeshData& model);
+void npMarkPointsDirty(const float3 *vertices, bool refit = false);
+
+
+// rigid transform as a unit dual quaternion. blended as a flat array of 8 floats.
+struct npDualQuat
+{
+    quatf       real; // rotation
+    quatf       dual; // 0.5 * translation * real
+};
+
+// derived data of skin weights. kept as long as the weights buffer is the same.
+class npSkinCache
+{
+public:
+    bool matches(const npSkinData& skin) const;
+    void reset(const npSkinData& skin);
+
+    // vertices influenced by any of the bones (with non-zero weights) in ascending order.
+    void getInfluencedVertices(const int bones[], int num_bones, RawVector<int>& dst);
+    // variable layout (npSkinData::bones_per_vertex): index of the first npBoneWeight1 of each vertex.
+    // num_vertices + 1 elements. the last one is the total number of npBoneWeight1.
+    const RawVector<int>& getWeightOffsets();
+
+    // bindposes[bi] * bones[bi] * invert(root) of each bone and their inverses.
+    // only bones whose matrices are changed since the last call are recomputed.
+    const RawVector<float4x4>& getPoses(const npSkinData& skin);
+    const RawVector<float4x4>& getInversePoses(const npSkinData& skin);
+    // getPoses() as dual quaternions. available only if skin.skinning_method is npSkinningDualQuaternion.
+    const RawVector<npDualQuat>& getDualQuaternions(const npSkinData& skin);
+
+private:
+    void buildBoneIndex();
+    void updatePoses(const npSkinData& skin);
+    // bones that influence vertex vi. a bone is listed once even if it appears in multiple influences.
+    int getInfluencingBones(int vi, int *dst);
+
+    const void      *m_weights = nullptr;
+    int             m_influences_per_vertex = 4;
+    const npBoneWeight1 *m_weights1 = nullptr;
+    const uint8_t   *m_bones_per_vertex = nullptr;
+    int             m_skinning_method = npSkinningLinear;
+    int             m_num_vertices = 0;
+    int             m_num_bones = 0;
+
+    RawVector<int>  m_weight_offsets;
+    bool            m_weight_offsets_dirty = true;
+
+    // bone to vertex index. vertices of bone bi are m_bone_vertices[m_bone_offsets[bi]...m_bone_offsets[bi+1]]
+    RawVector<int>  m_bone_offsets;
+    RawVector<int>  m_bone_vertices;
+    bool            m_bone_index_dirty = true;
+
+    // matrices the poses are computed from
+    RawVector<float4x4> m_bones;
+    RawVector<float4x4> m_bindposes;
+    float4x4        m_root = float4x4::identity();
+    RawVector<float4x4> m_poses;
+    RawVector<float4x4> m_iposes;
+    RawVector<npDualQuat> m_dqs;
+    bool            m_poses_dirty = true;
+};
+using npSkinCachePtr = std::shared_ptr<npSkinCache>;
+
+npSkinCachePtr npGetSkinCache(const npSkinData& skin);
@@ -0,0 +1,313 @@
+#include "pch.h"
+#include "NormalPainter.h"
+#include "npModelCache.h"
+
+// skinning methods. a method blends its palette (Size floats per bone) by weights, converts the blended value
+// into a matrix once per vertex and transforms points, normals and tangents by it.
+
+// linear blend skinning by the blended matrix: sum(M[i] * w[i]) * v == sum((M[i] * v) * w[i]).
+// one matrix-vector product per attribute instead of one per influence.
+struct npLinearBlend
+{
+    using value_t = float4x4;
+    static const int Size = 16;
+    const float4x4 *poses;
+
+    const float* get(int bi) const { return &poses[bi][0][0]; }
+    float weight(const float * /*first*/, const float * /*src*/, float w) const { return w; }
+    const float4x4* toMatrices(const value_t blended[], float4x4 /*tmp*/[], int /*n*/) const { return blended; }
+    float tangentW(const float4& t, float wsum) const { return t.w * wsum; }
+};
+
+// dual quaternion skinning. rotations are blended on the sphere so that twisted joints keep their volume.
+// the palette is half the size of matrices. the blended dual quaternion is normalized and converted into
+// a rigid matrix, so that attributes cost the same as linear blend skinning.
+// Inverse: transform by the inverse of the blended transform, which exactly undoes the forward one.
+template<bool Inverse>
+struct npDualQuatBlend
+{
+    using value_t = npDualQuat;
+    static const int Size = 8;
+    const npDualQuat *dqs;
+
+    const float* get(int bi) const { return &dqs[bi].real.x; }
+    // q and -q are the same rotation. blend the one closer to the first influence's.
+    float weight(const float *first, const float *src, float w) const
+    {
+        // copysign() instead of a branch. signs of dot products are unpredictable.
+        float d = first[0] * src[0] + first[1] * src[1] + first[2] * src[2] + first[3] * src[3];
+        return w * std::copysign(1.0f, d);
+    }
+    // converted in a loop over a tile of vertices so that compilers can vectorize it across vertices.
+    const float4x4* toMatrices(const value_t blended[], float4x4 dst[], int n) const
+    {
+        for (int k = 0; k < n; ++k) {
+            auto& r = blended[k].real;
+            auto& d = blended[k].dual;
+
+            // rotation of r / |r| without sqrt. r is zero only if all weights are zero. it results in identity.
+            // FLT_MIN avoids division by zero without branches (it doesn't change sums of normalized weights).
+            float s = 2.0f / (r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w + FLT_MIN);
+            float xx = r.x * r.x * s, yy = r.y * r.y * s, zz = r.z * r.z * s;
+            float xy = r.x * r.y * s, xz = r.x * r.z * s, yz = r.y * r.z * s;
+            float wx = r.w * r.x * s, wy = r.w * r.y * s, wz = r.w * r.z * s;
+            float3 c0 = { 1.0f - (yy + zz), xy + wz, xz - wy };
+            float3 c1 = { xy - wz, 1.0f - (xx + zz), yz + wx };
+            float3 c2 = { xz + wy, yz - wx, 1.0f - (xx + yy) };
+            // translation: vector part of 2 * dual * conjugate(real) / |real|^2
+            float3 rv = { r.x, r.y, r.z };
+            float3 dv = { d.x, d.y, d.z };
+            float3 t = (dv * r.w - rv * d.w + cross(rv, dv)) * s;
+
+            if (Inverse) {
+                // transposed rotation and rotated negative translation
+                dst[k] = float4x4{ {
+                    { c0.x, c1.x, c2.x, 0.0f },
+                    { c0.y, c1.y, c2.y, 0.0f },
+                    { c0.z, c1.z, c2.z, 0.0f },
+                    { -dot(c0, t), -dot(c1, t), -dot(c2, t), 1.0f },
+                } };
+            }
+            else {
+                dst[k] = float4x4{ {
+                    { c0.x, c0.y, c0.z, 0.0f },
+                    { c1.x, c1.y, c1.z, 0.0f },
+                    { c2.x, c2.y, c2.z, 0.0f },
+                    { t.x, t.y, t.z, 1.0f },
+                } };
+            }
+        }
+        return dst;
+    }
+    float tangentW(const float4& t, float /*wsum*/) const { return t.w; }
+};
+
+// palette entries are blended as flat arrays of floats so that compilers can vectorize it.
+// NumInfluence is a compile-time constant so that the loop over influences is fully unrolled.
+// weights[i * Stride] and indices[i * Stride] are the i-th influence. wsum: sum of weights.
+template<int NumInfluence, int Stride, class Method>
+static inline void BlendPoses(const Method& method, const float *weights, const int *indices, typename Method::value_t& r, float& wsum)
+{
+    // accumulate in locals. r and wsum may alias the inputs as far as compilers know.
+    const int Size = Method::Size;
+    float dst[Size];
+    const float *first = method.get(indices[0]);
+    float sum = weights[0];
+    for (int i = 0; i < Size; ++i) { dst[i] = first[i] * sum; }
+    for (int ii = 1; ii < NumInfluence; ++ii) {
+        const float *src = method.get(indices[ii * Stride]);
+        float s = method.weight(first, src, weights[ii * Stride]);
+        for (int i = 0; i < Size; ++i) { dst[i] += src[i] * s; }
+        sum += weights[ii * Stride];
+    }
+    memcpy(&r, dst, sizeof(dst));
+    wsum = sum;
+}
+
+// for vertices with no or more than 8 influences in the variable layout
+template<class Method>
+static inline void BlendPoses(const Method& method, const npBoneWeight1 *weights, int num_influences, typename Method::value_t& r, float& wsum)
+{
+    const int Size = Method::Size;
+    float *dst = (float*)&r;
+    for (int i = 0; i < Size; ++i) { dst[i] = 0.0f; }
+    wsum = 0.0f;
+    if (num_influences == 0) { return; }
+
+    const float *first = method.get(weights[0].index);
+    for (int ii = 0; ii < num_influences; ++ii) {
+        const float *src = method.get(weights[ii].index);
+        float s = method.weight(first, src, weights[ii].weight);
+        for (int i = 0; i < Size; ++i) { dst[i] += src[i] * s; }
+        wsum += weights[ii].weight;
+    }
+}
+
+// Weights<N> per vertex
+template<int NumInfluence>
+struct npFixedWeights
+{
+    const Weights<NumInfluence> *weights;
+
+    template<class Method>
+    void blend(const Method& method, int vi, typename Method::value_t& r, float& wsum) const
+    {
+        const auto& w = weights[vi];
+        BlendPoses<NumInfluence, 1>(method, w.weights, w.indices, r, wsum);
+    }
+};
+
+// variable number of npBoneWeight1 per vertex. dispatched to the kernel specialized for the count.
+struct npVariableWeights
+{
+    const npBoneWeight1 *weights;
+    const uint8_t *counts;
+    const int *offsets;
+
+    template<class Method>
+    void blend(const Method& method, int vi, typename Method::value_t& r, float& wsum) const
+    {
+        const auto *w = weights + offsets[vi];
+        const float *ws = &w->weight;
+        const int *is = &w->index;
+        switch (counts[vi]) {
+        case 1: BlendPoses<1, 2>(method, ws, is, r, wsum); break;
+        case 2: BlendPoses<2, 2>(method, ws, is, r, wsum); break;
+        case 3: BlendPoses<3, 2>(method, ws, is, r, wsum); break;
+        case 4: BlendPoses<4, 2>(method, ws, is, r, wsum); break;
+        case 5: BlendPoses<5, 2>(method, ws, is, r, wsum); break;
+        case 6: BlendPoses<6, 2>(method, ws, is, r, wsum); break;
+        case 7: BlendPoses<7, 2>(method, ws, is, r, wsum); break;
+        case 8: BlendPoses<8, 2>(method, ws, is, r, wsum); break;
+        default: BlendPoses(method, w, counts[vi], r, wsum); break;
+        }
+    }
+};
+
+// blended values of a tile of vertices are converted into matrices at once
+#define npSkinTileSize 64
+
+// points, normals and tangents of a vertex are skinned together in blocks of vertices.
+// vindices: vertices to skin (num_vertices elements). all vertices if null. inputs and outputs can be the same.
+template<class Method, class SkinWeights>
+static void SkinningImpl(
+    int num_vertices, const int vindices[], const Method& method, const SkinWeights& weights,
+    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
+    float3 opoints[], float3 onormals[], float4 otangents[])
+{
+    bool do_points = ipoints && opoints;
+    bool do_normals = inormals && onormals;
+    bool do_tangents = itangents && otangents;
+    if (!do_points && !do_normals && !do_tangents) { return; }
+
+    parallel_for_blocked(0, num_vertices, npVertexBlockSize, [&](int i, int iend) {
+        typename Method::value_t blended[npSkinTileSize];
+        float4x4 tmp[npSkinTileSize];
+        float wsum[npSkinTileSize];
+        int vis[npSkinTileSize];
+        while (i < iend) {
+            int n = std::min<int>(iend - i, npSkinTileSize);
+            for (int k = 0; k < n; ++k) {
+                int vi = vindices ? vindices[i + k] : i + k;
+                vis[k] = vi;
+                weights.blend(method, vi, blended[k], wsum[k]);
+            }
+            const float4x4 *mats = method.toMatrices(blended, tmp, n);
+            for (int k = 0; k < n; ++k) {
+                int vi = vis[k];
+                const auto& m = mats[k];
+                if (do_points) {
+                    opoints[vi] = mul_p(m, ipoints[vi]);
+                }
+                if (do_normals) {
+                    onormals[vi] = normalize(mul_v(m, inormals[vi]));
+                }
+                if (do_tangents) {
+                    float4 t = itangents[vi];
+                    float4 rt = mul_v(m, t);
+                    rt.w = method.tangentW(t, wsum[k]);
+                    otangents[vi] = rt;
+                }
+            }
+            i += n;
+        }
+    });
+}
+
+// select the kernel for the weights layout of skin
+template<class Method>
+static void SkinningImpl(
+    const npSkinData& skin, npSkinCache& cache,
+    int num_vertices, const int vindices[], const Method& method,
+    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
+    float3 opoints[], float3 onormals[], float4 otangents[])
+{
+#define Impl(W) SkinningImpl(num_vertices, vindices, method, W, ipoints, inormals, itangents, opoints, onormals, otangents)
+    if (skin.bones_per_vertex) {
+        npVariableWeights w = { skin.weights1, skin.bones_per_vertex, cache.getWeightOffsets().data() };
+        Impl(w);
+        return;
+    }
+    switch (skin.influences_per_vertex) {
+    case 1: { npFixedWeights<1> w = { (const Weights<1>*)skin.weights }; Impl(w); break; }
+    case 2: { npFixedWeights<2> w = { (const Weights<2>*)skin.weights }; Impl(w); break; }
+    case 8: { npFixedWeights<8> w = { (const Weights<8>*)skin.weights }; Impl(w); break; }
+    default: { npFixedWeights<4> w = { (const Weights<4>*)skin.weights }; Impl(w); break; }
+    }
+#undef Impl
+}
+
+// select the skinning method of skin
+// reverse: undo the skinning. linear blend skinning uses inverse poses, which is an approximation.
+static void SkinningImpl(
+    const npSkinData& skin, npSkinCache& cache, bool reverse,
+    int num_vertices, const int vindices[],
+    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
+    float3 opoints[], float3 onormals[], float4 otangents[])
+{
+    if (skin.skinning_method == npSkinningDualQuaternion) {
+        auto *dqs = cache.getDualQuaternions(skin).data();
+        if (reverse) {
+            npDualQuatBlend<true> method = { dqs };
+            SkinningImpl(skin, cache, num_vertices, vindices, method, ipoints, inormals, itangents, opoints, onormals, otangents);
+        }
+        else {
+            npDualQuatBlend<false> method = { dqs };
+            SkinningImpl(skin, cache, num_vertices, vindices, method, ipoints, inormals, itangents, opoints, onormals, otangents);
+        }
+    }
+    else {
+        npLinearBlend method = { reverse ? cache.getInversePoses(skin).data() : cache.getPoses(skin).data() };
+        SkinningImpl(skin, cache, num_vertices, vindices, method, ipoints, inormals, itangents, opoints, onormals, otangents);
+    }
+}
+
+npAPI void npApplySkinning(
+    npSkinData *skin,
+    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
+    float3 opoints[], float3 onormals[], float4 otangents[])
+{
+    auto cache = npGetSkinCache(*skin);
+    SkinningImpl(*skin, *cache, false, skin->num_vertices, nullptr, ipoints, inormals, itangents, opoints, onormals, otangents);
+    // posed vertices are picked and brushed right after this. refit BVHs of them now.
+    npMarkPointsDirty(opoints, true);
+}
+
+// re-skin only vertices influenced by the bones. other vertices of outputs are left as they are,
+// so outputs must hold the results of the previous skinning.
+npAPI void npApplySkinningPartial(
+    npSkinData *skin, const int bones[], int num_bones,
+    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
+    float3 opoints[], float3 onormals[], float4 otangents[])
+{
+    auto cache = npGetSkinCache(*skin);
+    RawVector<int> vindices;
+    cache->getInfluencedVertices(bones, num_bones, vindices);
+    if (vindices.empty()) { return; }
+
+    SkinningImpl(*skin, *cache, false, (int)vindices.size(), vindices.data(), ipoints, inormals, itangents, opoints, onormals, otangents);
+    npMarkPointsDirty(opoints, true);
+}
+
+npAPI void npApplyReverseSkinning(
+    npSkinData *skin,
+    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
+    float3 opoints[], float3 onormals[], float4 otangents[])
+{
+    auto cache = npGetSkinCache(*skin);
+    SkinningImpl(*skin, *cache, true, skin->num_vertices, nullptr, ipoints, inormals, itangents, opoints, onormals, otangents);
+    npMarkPointsDirty(opoints);
+}
+
+// reverse skinning of the given vertices only (e.g. vertices edited by a brush stroke).
+npAPI void npApplyReverseSkinningIndexed(
+    npSkinData *skin, const int vindices[], int num_vindices,
+    const float3 ipoints[], const float3 inormals[], const float4 itangents[],
+    float3 opoints[], float3 onormals[], float4 otangents[])
+{
+    if (!vindices || num_vindices <= 0) { return; }
+
+    auto cache = npGetSkinCache(*skin);
+    SkinningImpl(*skin, *cache, true, num_vindices, vindices, ipoints, inormals, itangents, opoints, onormals, otangents);
+    npMarkPointsDirty(opoints);
+}
@@ -0,0 +1,200 @@
+#include "pch.h"
+#include "NormalPainter.h"
+#include "npModelCache.h"
+
+// terrain mesh from a heightmap (width x height texels, one vertex per texel).
+// heightmap is in 0-1 and scaled by size.y. the mesh spans size.x and size.z.
+struct npTerrain
+{
+    const float *heightmap;
+    int width, height;
+    float3 size;
+    float3 unit; // distance between adjacent vertices
+    float2 uv_unit;
+
+    npTerrain(const float heightmap_[], int width_, int height_, float3 size_)
+        : heightmap(heightmap_), width(width_), height(height_), size(size_)
+    {
+        unit = float3{ 1.0f / (width - 1), 1.0f, 1.0f / (height - 1) } *size;
+        uv_unit = float2{ 1.0f / (width - 1), 1.0f / (height - 1) };
+    }
+
+    // vertices, normals and uv of texels [x0, x1) x [y0, y1).
+    // dst index of texel (ix, iy) is (iy - oy) * pitch + (ix - ox). any of dst can be null.
+    // normals are computed from the heightmap by central differences (one-sided at edges),
+    // so vertices of separate calls (chunks, dirty rects) get the same normals as a whole mesh.
+    void generateVertices(int x0, int y0, int x1, int y1, int ox, int oy, int pitch,
+        float3 dst_vertices[], float3 dst_normals[], float2 dst_uv[]) const;
+
+    // indices of quads between vertices [x0, x1) x [y0, y1). vertex index of texel (ix, iy) is
+    // (iy - y0) * (x1 - x0) + (ix - x0). (x1 - x0 - 1) * (y1 - y0 - 1) * 6 indices.
+    void generateIndices(int x0, int y0, int x1, int y1, int dst_indices[]) const;
+};
+
+#define npTerrainTileSize 64
+
+// rows per task so that each task has about npVertexBlockSize vertices
+static inline int GetRowBlockSize(int num_columns)
+{
+    return std::max<int>(npVertexBlockSize / std::max<int>(num_columns, 1), 1);
+}
+
+void npTerrain::generateVertices(int x0, int y0, int x1, int y1, int ox, int oy, int pitch,
+    float3 dst_vertices[], float3 dst_normals[], float2 dst_uv[]) const
+{
+    // interior columns: x slope = (h[ix + 1] - h[ix - 1]) * size.y / (2 * unit.x)
+    float sx = size.y / (2.0f * unit.x);
+    float sx_edge = size.y / unit.x;
+    int ix_begin = std::max<int>(x0, 1);
+    int ix_end = std::min<int>(x1, width - 1);
+
+    parallel_for_blocked(0, y1 - y0, GetRowBlockSize(x1 - x0), [&](int ry, int ry_end) {
+        for (int iy = y0 + ry; iy < y0 + ry_end; ++iy) {
+            const float *row = heightmap + width * iy;
+            int i = (iy - oy) * pitch - ox;
+
+            if (dst_vertices || dst_uv) {
+                for (int ix = x0; ix < x1; ++ix) {
+                    if (dst_vertices) {
+                        dst_vertices[i + ix] = float3{ (float)ix, row[ix], (float)iy } * unit;
+                    }
+                    if (dst_uv) {
+                        dst_uv[i + ix] = float2{ (float)ix, (float)iy } * uv_unit;
+                    }
+                }
+            }
+
+            if (dst_normals) {
+                int iy_prev = std::max<int>(iy - 1, 0);
+                int iy_next = std::min<int>(iy + 1, height - 1);
+                const float *row_prev = heightmap + width * iy_prev;
+                const float *row_next = heightmap + width * iy_next;
+                float sz = size.y / ((iy_next - iy_prev) * unit.z);
+
+                auto edge_normal = [&](int ix) {
+                    int ix_prev = std::max<int>(ix - 1, 0);
+                    int ix_next = std::min<int>(ix + 1, width - 1);
+                    float dx = (row[ix_next] - row[ix_prev]) * (ix_next - ix_prev == 2 ? sx : sx_edge);
+                    float dz = (row_next[ix] - row_prev[ix]) * sz;
+                    dst_normals[i + ix] = normalize(float3{ -dx, 1.0f, -dz });
+                };
+
+                if (x0 < ix_begin) { edge_normal(x0); }
+                // computed in SoA and then stored so that compilers can vectorize it
+                float nx[npTerrainTileSize], ny[npTerrainTileSize], nz[npTerrainTileSize];
+                for (int bx = ix_begin; bx < ix_end; bx += npTerrainTileSize) {
+                    int n = std::min<int>(ix_end - bx, npTerrainTileSize);
+                    for (int k = 0; k < n; ++k) {
+                        int ix = bx + k;
+                        float dx = (row[ix + 1] - row[ix - 1]) * sx;
+                        float dz = (row_next[ix] - row_prev[ix]) * sz;
+                        float rl = 1.0f / std::sqrt(dx * dx + dz * dz + 1.0f);
+                        nx[k] = -dx * rl;
+                        ny[k] = rl;
+                        nz[k] = -dz * rl;
+                    }
+                    auto *dst = dst_normals + (i + bx);
+                    for (int k = 0; k < n; ++k) {
+                        dst[k] = { nx[k], ny[k], nz[k] };
+                    }
+                }
+                if (ix_end < x1) { edge_normal(ix_end); }
+            }
+        }
+    });
+}
+
+void npTerrain::generateIndices(int x0, int y0, int x1, int y1, int dst_indices[]) const
+{
+    int pitch = x1 - x0;
+    int num_quads_x = x1 - x0 - 1;
+    parallel_for_blocked(0, y1 - y0 - 1, GetRowBlockSize(pitch), [&](int iy, int iy_end) {
+        for (; iy < iy_end; ++iy) {
+            for (int ix = 0; ix < num_quads_x; ++ix) {
+                int i6 = (iy * num_quads_x + ix) * 6;
+                dst_indices[i6 + 0] = pitch*iy + ix;
+                dst_indices[i6 + 1] = pitch*(iy + 1) + ix;
+                dst_indices[i6 + 2] = pitch*(iy + 1) + (ix + 1);
+
+                dst_indices[i6 + 3] = pitch*iy + ix;
+                dst_indices[i6 + 4] = pitch*(iy + 1) + (ix + 1);
+                dst_indices[i6 + 5] = pitch*iy + (ix + 1);
+            }
+        }
+    });
+}
+
+
+npAPI void npGenerateTerrainMesh(
+    const float heightmap[], int width, int height, float3 size,
+    float3 dst_vertices[], float3 dst_normals[], float2 dst_uv[], int dst_indices[])
+{
+    if (width < 2 || height < 2) { return; }
+
+    npTerrain terrain(heightmap, width, height, size);
+    terrain.generateVertices(0, 0, width, height, 0, 0, width, dst_vertices, dst_normals, dst_uv);
+    if (dst_indices) {
+        terrain.generateIndices(0, 0, width, height, dst_indices);
+    }
+    // the buffers may be reused (e.g. re-extraction of the same terrain). drop caches of old vertices.
+    npMarkPointsDirty(dst_vertices);
+}
+
+// a chunk of the terrain: chunk_width x chunk_height vertices from texel (x, y). clamped to the heightmap.
+// adjacent chunks should share edges (e.g. x = i * (chunk_width - 1)) to be seamless.
+// vertices and uv are in the space of the whole terrain and normals are the same as npGenerateTerrainMesh(),
+// so there are no seams. indices are local to the chunk: chunks of up to 65536 vertices fit in 16 bit indices.
+// returns the number of vertices. dst arrays must have room for chunk_width * chunk_height vertices and
+// (chunk_width - 1) * (chunk_height - 1) * 6 indices.
+// native API only for now: MeshData.Extract(Terrain) on the C# side still makes a single mesh.
+npAPI int npGenerateTerrainChunk(
+    const float heightmap[], int width, int height, float3 size,
+    int x, int y, int chunk_width, int chunk_height,
+    float3 dst_vertices[], float3 dst_normals[], float2 dst_uv[], int dst_indices[])
+{
+    if (width < 2 || height < 2) { return 0; }
+
+    int x1 = std::min<int>(x + chunk_width, width);
+    int y1 = std::min<int>(y + chunk_height, height);
+    x = std::max<int>(x, 0);
+    y = std::max<int>(y, 0);
+    if (x1 - x < 2 || y1 - y < 2) { return 0; }
+
+    npTerrain terrain(heightmap, width, height, size);
+    terrain.generateVertices(x, y, x1, y1, x, y, x1 - x, dst_vertices, dst_normals, dst_uv);
+    if (dst_indices) {
+        terrain.generateIndices(x, y, x1, y1, dst_indices);
+    }
+    // same as npGenerateTerrainMesh(): chunk buffers may be reused
+    npMarkPointsDirty(dst_vertices);
+    return (x1 - x) * (y1 - y);
+}
+
+// incremental update of a mesh made by npGenerateTerrainMesh() after heights in the rect
+// [x, x + rect_width) x [y, y + rect_height) are modified. heightmap is the whole (updated) heightmap.
+// vertices of the rect and normals of the rect plus a one-texel border (normals depend on adjacent heights)
+// are updated. uv and indices are not changed.
+npAPI void npUpdateTerrainMesh(
+    const float heightmap[], int width, int height, float3 size,
+    int x, int y, int rect_width, int rect_height,
+    float3 dst_vertices[], float3 dst_normals[])
+{
+    if (width < 2 || height < 2) { return; }
+
+    int x0 = std::max<int>(x, 0);
+    int y0 = std::max<int>(y, 0);
+    int x1 = std::min<int>(x + rect_width, width);
+    int y1 = std::min<int>(y + rect_height, height);
+    if (x0 >= x1 || y0 >= y1) { return; }
+
+    npTerrain terrain(heightmap, width, height, size);
+    if (dst_vertices) {
+        terrain.generateVertices(x0, y0, x1, y1, 0, 0, width, dst_vertices, nullptr, nullptr);
+        npMarkPointsDirty(dst_vertices);
+    }
+    if (dst_normals) {
+        terrain.generateVertices(
+            std::max<int>(x0 - 1, 0), std::max<int>(y0 - 1, 0), std::min<int>(x1 + 1, width), std::min<int>(y1 + 1, height),
+            0, 0, width, nullptr, dst_normals, nullptr);
+    }
+}
@@ -9,6 +9,7 @@
 #include <vector>
 #include <map>
 #include <functional>
+#include <numeric>
 #include <memory>
 #include <iostream>
 #include <sstream>
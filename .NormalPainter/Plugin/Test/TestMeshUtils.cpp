@@ -108,7 +108,7 @@ TestCase(TestNormalsAndTangents)
     int num_triangles = (int)indices.size() / 3;
     RawVector<float3> points_f;
     RawVector<float2> uv_f;
-    RawVector<float3> normals[6];
+    RawVector<float3> normals[8];
     RawVector<float4> tangents[7];
     RawVector<float> psoa[9], usoa[6];
 
@@ -211,6 +211,47 @@ TestCase(TestNormalsAndTangents)
     ValidateNormals(normals[5]);
 #endif
 
+    ConnectionData connection;
+    TestScope("ConnectionData::buildConnection", [&]() {
+        connection.buildConnection(indices, 3, points);
+    });
+    TestScope("GenerateNormals with connection", [&]() {
+        GenerateNormalsWithConnection(normals[6], points, indices, 3, connection);
+    }, num_try);
+    ValidateNormals(normals[6]);
+
+    TestScope("GenerateNormals with connection (angle weighted)", [&]() {
+        GenerateNormalsWithConnection(normals[7], points, indices, 3, connection, NormalWeighting::Angle);
+    }, num_try);
+    ValidateNormals(normals[7]);
+
+    // a quad and a zero-area triangle that shares its diagonal.
+    // the triangle must not affect normals of the quad vertices in either weighting.
+    {
+        RawVector<float3> dpoints = {
+            { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f },
+            { 0.5f, 0.0f, 0.5f },
+        };
+        RawVector<int> dindices = { 0, 1, 2, 3, 0, 4, 2 };
+        RawVector<int> dcounts = { 4, 3 };
+        RawVector<int> doffsets = { 0, 4 };
+        RawVector<float3> dnormals;
+        dnormals.resize(dpoints.size());
+
+        ConnectionData dconnection;
+        dconnection.buildConnection(dindices, dcounts, doffsets, dpoints);
+        NormalWeighting weightings[] = { NormalWeighting::Area, NormalWeighting::Angle };
+        for (auto weighting : weightings) {
+            GenerateNormalsWithConnection(dnormals, dpoints, dindices, dcounts, doffsets, dconnection, weighting);
+            for (int i = 0; i < 4; ++i) {
+                if (!near_equal(dnormals[i], float3{ 0.0f, 1.0f, 0.0f })) {
+                    Print("        *** validation failed (degenerate triangle) ***\n");
+                    break;
+                }
+            }
+        }
+    }
+
 
     // generate tangents
 
@@ -360,6 +401,105 @@ TestCase(TestMulPoints)
 }
 
 
+TestCase(TestSIMDKernels)
+{
+    // not a multiple of SIMD width to test remainder loops
+    const int num_data = 65536 + 7;
+    const int num_try = 128;
+
+    RawVector<float3> src1, src2, dst1, dst2;
+    RawVector<float4> src4, dst41, dst42;
+    src1.resize(num_data); src2.resize(num_data);
+    dst1.resize(num_data); dst2.resize(num_data);
+    src4.resize(num_data); dst41.resize(num_data); dst42.resize(num_data);
+    for (int i = 0; i < num_data; ++i) {
+        src1[i] = { std::sin((float)i), (float)i*0.05f, -(float)i*0.025f };
+        src2[i] = { std::cos((float)i), -(float)i*0.1f, (float)i*0.0125f };
+        src4[i] = { (float)i*0.1f, (float)i*0.05f, (float)i*0.025f, 1.0f };
+    }
+
+    Print(
+        "    num_data: %d\n"
+        "    num_try: %d\n",
+        num_data,
+        num_try);
+
+    dst1 = src1; dst2 = src1;
+    TestScope("InvertX C++", [&]() {
+        InvertX_Generic(dst1.data(), num_data);
+    }, num_try);
+#ifdef muSIMD_InvertX3
+    TestScope("InvertX ISPC", [&]() {
+        InvertX_ISPC(dst2.data(), num_data);
+    }, num_try);
+    if (!NearEqual(dst1.data(), dst2.data(), num_data)) {
+        Print("    *** validation failed ***\n");
+    }
+#endif
+
+    dst41 = src4; dst42 = src4;
+    TestScope("InvertX float4 C++", [&]() {
+        InvertX_Generic(dst41.data(), num_data);
+    }, num_try + 1);
+#ifdef muSIMD_InvertX4
+    TestScope("InvertX float4 ISPC", [&]() {
+        InvertX_ISPC(dst42.data(), num_data);
+    }, num_try + 1);
+    if (!NearEqual(dst41.data(), dst42.data(), num_data)) {
+        Print("    *** validation failed ***\n");
+    }
+#endif
+
+    dst1 = src1; dst2 = src1;
+    TestScope("Scale C++", [&]() {
+        Scale_Generic(dst1.data(), -1.0f, num_data);
+    }, num_try + 1);
+#ifdef muSIMD_Scale
+    TestScope("Scale ISPC", [&]() {
+        Scale_ISPC(dst2.data(), -1.0f, num_data);
+    }, num_try + 1);
+    if (!NearEqual(dst1.data(), dst2.data(), num_data)) {
+        Print("    *** validation failed ***\n");
+    }
+#endif
+
+    TestScope("Lerp C++", [&]() {
+        Lerp_Generic((float*)dst1.data(), (float*)src1.data(), (float*)src2.data(), num_data * 3, 0.25f);
+    }, num_try);
+#ifdef muSIMD_Lerp
+    TestScope("Lerp ISPC", [&]() {
+        Lerp_ISPC((float*)dst2.data(), (float*)src1.data(), (float*)src2.data(), num_data * 3, 0.25f);
+    }, num_try);
+    if (!NearEqual(dst1.data(), dst2.data(), num_data)) {
+        Print("    *** validation failed ***\n");
+    }
+#endif
+
+    float3 min1, max1;
+    TestScope("MinMax C++", [&]() {
+        MinMax_Generic(src1.data(), num_data, min1, max1);
+    }, num_try);
+#ifdef muSIMD_MinMax3
+    float3 min2, max2;
+    TestScope("MinMax ISPC", [&]() {
+        MinMax_ISPC(src1.data(), num_data, min2, max2);
+    }, num_try);
+    if (min1 != min2 || max1 != max2) {
+        Print("    *** validation failed ***\n");
+    }
+
+    // small inputs: only one SIMD block or none
+    for (int n = 1; n <= 40; ++n) {
+        MinMax_Generic(src1.data(), n, min1, max1);
+        MinMax_ISPC(src1.data(), n, min2, max2);
+        if (min1 != min2 || max1 != max2) {
+            Print("    *** validation failed *** (MinMax %d)\n", n);
+        }
+    }
+#endif
+}
+
+
 TestCase(TestRayTrianglesIntersection)
 {
     RawVector<float3> vertices;
@@ -426,11 +566,22 @@ TestCase(TestRayTrianglesIntersection)
             num_hits, tindex, distance);
     };
 
+    // results of the indexed C++ version. the others must hit the same triangle at the same distance.
+    int ref_tindex;
+    float ref_distance;
+    auto ValidateResult = [&]() {
+        if (tindex != ref_tindex || !near_equal(distance, ref_distance)) {
+            Print("        *** validation failed ***\n");
+        }
+    };
+
     TestScope("RayTrianglesIntersection indexed C++", [&]() {
         num_hits = RayTrianglesIntersectionIndexed_Generic(ray_pos, ray_dir, vertices.data(),
             indices.data(), num_triangles, tindex, distance);
     }, num_try);
     PrintResult();
+    ref_tindex = tindex;
+    ref_distance = distance;
 
 #ifdef muSIMD_RayTrianglesIntersectionIndexed
     TestScope("RayTrianglesIntersection indexed ISPC", [&]() {
@@ -438,18 +589,21 @@ TestCase(TestRayTrianglesIntersection)
             indices.data(), num_triangles, tindex, distance);
     }, num_try);
     PrintResult();
+    ValidateResult();
 #endif
 
     TestScope("RayTrianglesIntersection flattened C++", [&]() {
         num_hits = RayTrianglesIntersectionFlattened_Generic(ray_pos, ray_dir, vertices_flattened.data(), num_triangles, tindex, distance);
     }, num_try);
     PrintResult();
+    ValidateResult();
 
 #ifdef muSIMD_RayTrianglesIntersectionFlattened
     TestScope("RayTrianglesIntersection flattened ISPC", [&]() {
         num_hits = RayTrianglesIntersectionFlattened_ISPC(ray_pos, ray_dir, vertices_flattened.data(), num_triangles, tindex, distance);
     }, num_try);
     PrintResult();
+    ValidateResult();
 #endif
 
     TestScope("RayTrianglesIntersection SoA C++", [&]() {
@@ -459,6 +613,7 @@ TestCase(TestRayTrianglesIntersection)
             v3x.data(), v3y.data(), v3z.data(), num_triangles, tindex, distance);
     }, num_try);
     PrintResult();
+    ValidateResult();
 
 #ifdef muSIMD_RayTrianglesIntersectionSoA
     TestScope("RayTrianglesIntersection SoA ISPC", [&]() {
@@ -468,10 +623,243 @@ TestCase(TestRayTrianglesIntersection)
             v3x.data(), v3y.data(), v3z.data(), num_triangles, tindex, distance);
     }, num_try);
     PrintResult();
+    ValidateResult();
 #endif
 }
 
 
+TestCase(TestBVH)
+{
+    RawVector<int> counts, indices;
+    RawVector<float3> points;
+    RawVector<float2> uv;
+    GenerateWaveMesh(counts, indices, points, uv, 10.0f, 0.5f, 256, 0.0f, true);
+    int num_triangles = (int)indices.size() / 3;
+
+    // rays shot from above toward random points on the mesh
+    const int num_rays = 2000;
+    RawVector<float3> ray_pos, ray_dir;
+    ray_pos.resize(num_rays);
+    ray_dir.resize(num_rays);
+    srand(0);
+    for (int i = 0; i < num_rays; ++i) {
+        auto rnd = []() { return (float)rand() / RAND_MAX - 0.5f; };
+        float3 target = { rnd() * 10.0f, 0.0f, rnd() * 10.0f };
+        ray_pos[i] = { rnd() * 10.0f, 5.0f, rnd() * 10.0f };
+        ray_dir[i] = normalize(target - ray_pos[i]);
+    }
+
+    Print(
+        "    triangle count: %d\n"
+        "    ray count: %d\n",
+        num_triangles,
+        num_rays);
+
+    TriangleBVH bvh;
+    TestScope("TriangleBVH::build", [&]() {
+        bvh.build(points.data(), indices.data(), num_triangles);
+    });
+    Print("    node count: %d\n", (int)bvh.nodes.size());
+
+    RawVector<int> ti1, ti2;
+    RawVector<float> d1, d2;
+    ti1.resize(num_rays); ti2.resize(num_rays);
+    d1.resize(num_rays); d2.resize(num_rays);
+
+    TestScope("RayTrianglesIntersection indexed C++", [&]() {
+        for (int i = 0; i < num_rays; ++i) {
+            ti1[i] = -1;
+            RayTrianglesIntersectionIndexed_Generic(ray_pos[i], ray_dir[i], points.data(), indices.data(), num_triangles, ti1[i], d1[i]);
+        }
+    });
+    TestScope("TriangleBVH::raycast", [&]() {
+        for (int i = 0; i < num_rays; ++i) {
+            ti2[i] = -1;
+            bvh.raycast(ray_pos[i], ray_dir[i], ti2[i], d2[i]);
+        }
+    });
+
+    int num_hits = 0;
+    for (int i = 0; i < num_rays; ++i) {
+        if (ti1[i] != -1) { ++num_hits; }
+        if (ti1[i] != ti2[i] || (ti1[i] != -1 && d1[i] != d2[i])) {
+            Print("    *** validation failed ***\n");
+            break;
+        }
+    }
+    Print("    %d hits\n", num_hits);
+}
+
+TestCase(TestBVHRefit)
+{
+    RawVector<int> counts, indices;
+    RawVector<float3> points;
+    RawVector<float2> uv;
+    GenerateWaveMesh(counts, indices, points, uv, 10.0f, 0.5f, 256, 0.0f, true);
+    int num_triangles = (int)indices.size() / 3;
+
+    TriangleBVH bvh;
+    bvh.build(points.data(), indices.data(), num_triangles);
+
+    // bend the mesh (like skinning) and refit
+    for (auto& p : points) {
+        float a = p.x * 0.1f;
+        p = { std::sin(a) * (5.0f + p.y), std::cos(a) * (5.0f + p.y) - 5.0f, p.z };
+    }
+    float ratio = 0.0f;
+    TestScope("TriangleBVH::refit", [&]() {
+        ratio = bvh.refit();
+    });
+    TriangleBVH rebuilt;
+    TestScope("TriangleBVH::build", [&]() {
+        rebuilt.build(points.data(), indices.data(), num_triangles);
+    });
+    Print("    cost ratio: %.3f (rebuilt: %.3f)\n", ratio, rebuilt.getCost() / bvh.build_cost);
+
+    // rays toward random points on the bent mesh
+    const int num_rays = 1000;
+    int num_hits = 0;
+    srand(0);
+    for (int i = 0; i < num_rays; ++i) {
+        auto rnd = []() { return (float)rand() / RAND_MAX - 0.5f; };
+        float3 pos = { rnd() * 10.0f, 10.0f, rnd() * 10.0f };
+        float3 dir = normalize(points[rand() % points.size()] - pos);
+
+        int ti1 = -1, ti2 = -1;
+        float d1, d2;
+        RayTrianglesIntersectionIndexed_Generic(pos, dir, points.data(), indices.data(), num_triangles, ti1, d1);
+        bvh.raycast(pos, dir, ti2, d2);
+        if (ti1 != -1) { ++num_hits; }
+        if (ti1 != ti2 || (ti1 != -1 && d1 != d2)) {
+            Print("    *** validation failed ***\n");
+            break;
+        }
+    }
+    Print("    %d hits\n", num_hits);
+}
+
+TestCase(TestPointGrid)
+{
+    RawVector<int> counts, indices;
+    RawVector<float3> points;
+    RawVector<float2> uv;
+    GenerateWaveMesh(counts, indices, points, uv, 10.0f, 0.5f, 512, 0.0f, true);
+    int num_points = (int)points.size();
+
+    const int num_queries = 1000;
+    const float radius = 0.3f;
+    RawVector<float3> centers;
+    centers.resize(num_queries);
+    srand(0);
+    for (int i = 0; i < num_queries; ++i) {
+        auto rnd = []() { return (float)rand() / RAND_MAX - 0.5f; };
+        centers[i] = { rnd() * 10.0f, rnd(), rnd() * 10.0f };
+    }
+
+    Print(
+        "    point count: %d\n"
+        "    query count: %d\n",
+        num_points,
+        num_queries);
+
+    PointGrid grid;
+    TestScope("PointGrid::build", [&]() {
+        grid.build(points.data(), num_points);
+    });
+    Print("    cell size: %f\n", grid.cell_size);
+
+    float rq = radius * radius;
+    RawVector<int> hits1, hits2, candidates;
+    TestScope("brute force", [&]() {
+        for (int i = 0; i < num_queries; ++i) {
+            for (int pi = 0; pi < num_points; ++pi) {
+                if (length_sq(points[pi] - centers[i]) <= rq) { hits1.push_back(pi); }
+            }
+        }
+    });
+    TestScope("PointGrid::gatherPointsInBox", [&]() {
+        for (int i = 0; i < num_queries; ++i) {
+            grid.gatherPointsInBox(centers[i] - radius, centers[i] + radius, candidates);
+            for (int pi : candidates) {
+                if (length_sq(points[pi] - centers[i]) <= rq) { hits2.push_back(pi); }
+            }
+        }
+    });
+
+    Print("    %d hits\n", (int)hits1.size());
+    if (hits1.size() != hits2.size() || !std::equal(hits1.begin(), hits1.end(), hits2.begin())) {
+        Print("    *** validation failed ***\n");
+    }
+}
+
+static int ParallelFib(int n)
+{
+    if (n < 2) { return n; }
+    int a, b;
+    parallel_invoke([&]() { a = ParallelFib(n - 1); }, [&]() { b = ParallelFib(n - 2); });
+    return a + b;
+}
+
+TestCase(TestConcurrency)
+{
+    const int num = 1000000;
+    RawVector<int> data;
+    data.resize_zeroclear(num);
+
+    TestScope("parallel_for", [&]() {
+        parallel_for(0, num, [&](int i) { data[i] += i % 7; });
+    });
+    TestScope("parallel_for_blocked", [&]() {
+        parallel_for_blocked(0, num, 1024, [&](int i, int end) {
+            for (; i < end; ++i) { data[i] += 1; }
+        });
+    });
+
+    // nested tasks
+    int fib = 0;
+    TestScope("parallel_invoke (nested)", [&]() {
+        fib = ParallelFib(20);
+    });
+
+    int64_t sum = 0;
+    TestScope("parallel_reduce", [&]() {
+        sum = parallel_reduce(0, num, 1024, (int64_t)0, [&](int i, int end) {
+            int64_t s = 0;
+            for (; i < end; ++i) { s += data[i]; }
+            return s;
+        }, std::plus<int64_t>());
+    });
+
+    RawVector<int> offsets;
+    offsets.resize_discard(num);
+    int total = 0;
+    TestScope("parallel_scan", [&]() {
+        total = parallel_scan(data.data(), offsets.data(), num, 1024);
+    });
+
+    RawVector<int> compacted;
+    TestScope("parallel_compact", [&]() {
+        parallel_compact(0, num, 1024, compacted, [&](int i) { return data[i] == 1; });
+    });
+
+    bool ok = fib == 6765;
+    int64_t sum_ref = 0;
+    RawVector<int> compacted_ref;
+    for (int i = 0; i < num; ++i) {
+        if (data[i] != i % 7 + 1 || offsets[i] != (int)sum_ref) { ok = false; break; }
+        sum_ref += data[i];
+        if (data[i] == 1) { compacted_ref.push_back(i); }
+    }
+    if (sum != sum_ref || total != (int)sum_ref || compacted.size() != compacted_ref.size() ||
+        !std::equal(compacted.begin(), compacted.end(), compacted_ref.begin()))
+    {
+        ok = false;
+    }
+    if (!ok) {
+        Print("    *** validation failed ***\n");
+    }
+}
+
 TestCase(TestPolygonInside)
 {
     const int num_try = 100;
@@ -517,9 +517,10 @@ namespace UTJ.NormalPainterEditor
                 {
                     settings.smoothRadius = EditorGUILayout.FloatField("Smooth Radius", settings.smoothRadius);
                     settings.smoothAmount = EditorGUILayout.FloatField("Smooth Amount", settings.smoothAmount);
+                    settings.smoothIterations = EditorGUILayout.IntSlider("Smooth Iterations", settings.smoothIterations, 1, 16);
                     if (GUILayout.Button("Apply Smoothing [Shift+S]"))
                     {
-                        m_target.ApplySmoothing(settings.smoothRadius, settings.smoothAmount, true);
+                        m_target.ApplySmoothing(settings.smoothRadius, settings.smoothAmount, settings.smoothIterations, true);
                     }
                 }
                 else if (settings.smoothMode == 1)
@@ -943,7 +944,7 @@ namespace UTJ.NormalPainterEditor
                 {
                     handled = true;
                     tips = "Apply Smoothing";
-                    m_target.ApplySmoothing(settings.smoothRadius, settings.smoothAmount, true);
+                    m_target.ApplySmoothing(settings.smoothRadius, settings.smoothAmount, settings.smoothIterations, true);
                 }
                 else if (e.keyCode == KeyCode.W && e.shift)
                 {
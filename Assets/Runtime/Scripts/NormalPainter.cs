@@ -66,8 +66,14 @@ namespace UTJ.NormalPainter
         PinnedList<float> m_selection;
 
         PinnedList<BoneWeight> m_boneWeights;
+#if UNITY_2019_1_OR_NEWER
+        PinnedList<BoneWeight1> m_boneWeights1;
+        PinnedList<byte> m_bonesPerVertex;
+#endif
         PinnedList<Matrix4x4> m_bindposes;
         PinnedList<Matrix4x4> m_boneMatrices;
+        List<int> m_dirtyBones = new List<int>();
+        bool m_rootMatrixDirty;
 
         bool m_editing;
         bool m_edited;
@@ -90,6 +96,7 @@ namespace UTJ.NormalPainter
 
         npMeshData m_npModelData = new npMeshData();
         npSkinData m_npSkinData = new npSkinData();
+        IntPtr m_npModel = IntPtr.Zero;
 
         public bool editing
         {
@@ -120,6 +127,7 @@ namespace UTJ.NormalPainter
                 if (value != null && value.Length == m_selection.Count)
                 {
                     Array.Copy(value, m_selection.Array, m_selection.Count);
+                    MarkSelectionDirty();
                     UpdateSelection();
                 }
             }
@@ -287,12 +295,22 @@ namespace UTJ.NormalPainter
                 m_npModelData.uv = m_uv;
                 m_npModelData.selection = m_selection;
 
+                // keeps native caches (BVH, grid, connection etc) while editing
+                if (m_npModel != IntPtr.Zero) npDestroyModel(m_npModel);
+                m_npModel = npCreateModel(ref m_npModelData);
+
                 var smr = GetComponent<SkinnedMeshRenderer>();
                 if (smr != null && smr.bones.Length > 0)
                 {
                     m_skinned = true;
 
+#if UNITY_2019_1_OR_NEWER
+                    // all influences (not limited to 4 per vertex)
+                    m_boneWeights1 = new PinnedList<BoneWeight1>(m_meshTarget.GetAllBoneWeights().ToArray());
+                    m_bonesPerVertex = new PinnedList<byte>(m_meshTarget.GetBonesPerVertex().ToArray());
+#else
                     m_boneWeights = new PinnedList<BoneWeight>(m_meshTarget.boneWeights);
+#endif
                     m_bindposes = new PinnedList<Matrix4x4>(m_meshTarget.bindposes);
                     m_boneMatrices = new PinnedList<Matrix4x4>(m_bindposes.Count);
 
@@ -302,9 +320,16 @@ namespace UTJ.NormalPainter
                     m_tangentsPredeformed = m_tangents.Clone();
                     m_tangentsBasePredeformed = m_tangentsBase.Clone();
 
+#if UNITY_2019_1_OR_NEWER
+                    m_npSkinData.num_vertices = m_bonesPerVertex.Count;
+                    m_npSkinData.weights1 = m_boneWeights1;
+                    m_npSkinData.bones_per_vertex = m_bonesPerVertex;
+#else
                     m_npSkinData.num_vertices = m_boneWeights.Count;
-                    m_npSkinData.num_bones = m_bindposes.Count;
                     m_npSkinData.weights = m_boneWeights;
+                    m_npSkinData.influences_per_vertex = 4;
+#endif
+                    m_npSkinData.num_bones = m_bindposes.Count;
                     m_npSkinData.bindposes = m_bindposes;
                     m_npSkinData.bones = m_boneMatrices;
                 }
@@ -356,6 +381,7 @@ namespace UTJ.NormalPainter
         void EndEdit()
         {
             ReleaseComputeBuffers();
+            if (m_npModel != IntPtr.Zero) { npDestroyModel(m_npModel); m_npModel = IntPtr.Zero; }
             if(m_settings) m_settings.projectionNormalSource = null;
 
             m_editing = false;
@@ -668,7 +694,7 @@ namespace UTJ.NormalPainter
                 if (selectMode == SelectMode.Single)
                 {
                     if (!e.shift && !e.control)
-                        System.Array.Clear(m_selection.Array, 0, m_selection.Count);
+                        ClearSelection();
 
                     if (settings.selectVertex && SelectVertex(e, selectSign, settings.selectFrontSideOnly))
                     {
@@ -702,7 +728,7 @@ namespace UTJ.NormalPainter
                         {
                             m_rectDragging = false;
                             if (!e.shift && !e.control)
-                                System.Array.Clear(m_selection.Array, 0, m_selection.Count);
+                                ClearSelection();
 
                             m_rectEndPoint = e.mousePosition;
                             handled = true;
@@ -750,7 +776,7 @@ namespace UTJ.NormalPainter
                     else if (et == EventType.MouseUp)
                     {
                         if (!e.shift && !e.control)
-                            System.Array.Clear(m_selection.Array, 0, m_selection.Count);
+                            ClearSelection();
 
                         handled = true;
                         if (!SelectLasso(m_lassoPoints.ToArray(), selectSign, settings.selectFrontSideOnly) && !m_rayHit)
@@ -764,7 +790,7 @@ namespace UTJ.NormalPainter
                 else if (selectMode == SelectMode.Brush)
                 {
                     if (et == EventType.MouseDown && !e.shift && !e.control)
-                        System.Array.Clear(m_selection.Array, 0, m_selection.Count);
+                        ClearSelection();
 
                     if (et == EventType.MouseDown || et == EventType.MouseDrag)
                     {
@@ -4,6 +4,11 @@ using UnityEngine;
 #if UNITY_EDITOR
 using UnityEditor;
 #endif
+#if UNITY_2021_2_OR_NEWER
+using UnityEngine.TerrainTools;
+#elif UNITY_2018_3_OR_NEWER
+using UnityEngine.Experimental.TerrainAPI;
+#endif
 
 namespace UTJ.NormalPainter
 {
@@ -119,6 +124,8 @@ namespace UTJ.NormalPainter
                 if(value != _projectionNormalSource)
                 {
                     _projectionNormalSource = value;
+                    if (_projectionNormalSourceData != null)
+                        _projectionNormalSourceData.Dispose();
                     _projectionNormalSourceData = null;
                 }
             }
@@ -137,6 +144,28 @@ namespace UTJ.NormalPainter
             }
         }
 
+#if UNITY_2018_3_OR_NEWER
+        void OnEnable()
+        {
+            TerrainCallbacks.heightmapChanged += OnHeightmapChanged;
+        }
+
+        void OnDisable()
+        {
+            TerrainCallbacks.heightmapChanged -= OnHeightmapChanged;
+        }
+
+        // keeps the extracted normal source up to date while its terrain is edited.
+        // only the modified rect is re-extracted. not synched changes are not readable by GetHeights() yet.
+        void OnHeightmapChanged(Terrain terrain, RectInt heightRegion, bool synched)
+        {
+            if (!synched || _projectionNormalSourceData == null || _projectionNormalSource != terrain.gameObject)
+                return;
+            _projectionNormalSourceData.UpdateTerrain(terrain,
+                heightRegion.x, heightRegion.y, heightRegion.width, heightRegion.height);
+        }
+#endif
+
         // display options
         public bool showVertices = true;
         public bool showNormals = true;
@@ -180,6 +209,7 @@ namespace UTJ.NormalPainter
         [NonSerialized] public int smoothMode = 0;
         [NonSerialized] public float smoothRadius = 0.5f;
         [NonSerialized] public float smoothAmount = 1.0f;
+        [NonSerialized] public int smoothIterations = 1;
         [NonSerialized] public float weldAngle = 60.0f;
         [NonSerialized] public bool weldWithSmoothing = true;
         [NonSerialized] public int weldTargetsMode = 2;
@@ -55,6 +55,12 @@ namespace UTJ.NormalPainter
         DownToUp,
     }
 
+    public enum SkinningMethod
+    {
+        Linear,
+        DualQuaternion,
+    }
+
     public enum TangentsUpdateMode
     {
         Manual,
@@ -109,13 +115,15 @@ namespace UTJ.NormalPainter
         Direction,
     }
 
-    public class MeshData
+    public class MeshData : IDisposable
     {
         public PinnedList<Vector3> vertices = new PinnedList<Vector3>();
         public PinnedList<Vector3> normals = new PinnedList<Vector3>();
         public PinnedList<Vector2> uv = new PinnedList<Vector2>();
         public PinnedList<int> indices = new PinnedList<int>();
         public Matrix4x4 transform;
+        PinnedArray2D<float> m_heightmap; // kept for UpdateTerrain()
+        Vector3 m_terrainSize;
 
         public int vertexCount
         {
@@ -139,6 +147,21 @@ namespace UTJ.NormalPainter
 
         public bool empty { get { return vertices.Count == 0; } }
 
+        // releases the pinned heightmap kept for UpdateTerrain()
+        public void Dispose()
+        {
+            ReleaseHeightmap();
+        }
+
+        void ReleaseHeightmap()
+        {
+            if (m_heightmap != null)
+            {
+                m_heightmap.Dispose();
+                m_heightmap = null;
+            }
+        }
+
         public bool Extract(GameObject go)
         {
             if (!go) { return false; }
@@ -174,6 +197,7 @@ namespace UTJ.NormalPainter
         {
             if (!mesh || !mesh.isReadable) { return false; }
 
+            ReleaseHeightmap();
             vertexCount = mesh.vertexCount;
             mesh.GetVertices(vertices.List);
             mesh.GetNormals(normals.List);
@@ -195,11 +219,48 @@ namespace UTJ.NormalPainter
             indexCount = (w - 1) * (h - 1) * 2 * 3;
             npGenerateTerrainMesh(heightmap, w, h, tdata.size,
                 vertices, normals, uv, indices);
+            ReleaseHeightmap();
+            m_heightmap = heightmap;
+            m_terrainSize = tdata.size;
+            return true;
+        }
+
+        // re-extract only heights in the rect (e.g. after a terrain brush stroke).
+        // vertices of the rect and normals around it are updated. falls back to Extract() if the terrain is resized.
+        public bool UpdateTerrain(Terrain terrain, int x, int y, int width, int height)
+        {
+            if (!terrain) { return false; }
+
+            var tdata = terrain.terrainData;
+            var w = tdata.heightmapWidth;
+            var h = tdata.heightmapHeight;
+            if (m_heightmap == null || m_heightmap.Length != w * h || vertexCount != w * h || m_terrainSize != tdata.size)
+                return Extract(terrain);
+
+            int x0 = Mathf.Max(x, 0);
+            int y0 = Mathf.Max(y, 0);
+            int x1 = Mathf.Min(x + width, w);
+            int y1 = Mathf.Min(y + height, h);
+            if (x0 >= x1 || y0 >= y1) { return true; }
+
+            var heights = tdata.GetHeights(x0, y0, x1 - x0, y1 - y0);
+            var dst = m_heightmap.Array;
+            for (int iy = y0; iy < y1; ++iy)
+                for (int ix = x0; ix < x1; ++ix)
+                    dst[iy, ix] = heights[iy - y0, ix - x0];
+
+            npUpdateTerrainMesh(m_heightmap, w, h, tdata.size,
+                x0, y0, x1 - x0, y1 - y0, vertices, normals);
             return true;
         }
+
         [DllImport("NormalPainterCore")] static extern void npGenerateTerrainMesh(
             IntPtr heightmap, int width, int height, Vector3 size,
             IntPtr dst_vertices, IntPtr dst_normals, IntPtr dst_uv, IntPtr dst_indices);
+        [DllImport("NormalPainterCore")] static extern void npUpdateTerrainMesh(
+            IntPtr heightmap, int width, int height, Vector3 size,
+            int x, int y, int rect_width, int rect_height,
+            IntPtr dst_vertices, IntPtr dst_normals);
 
         public static implicit operator npMeshData(MeshData v)
         {
@@ -236,6 +297,10 @@ namespace UTJ.NormalPainter
         public int num_vertices;
         public int num_bones;
         public Matrix4x4 root;
+        public int influences_per_vertex; // 1, 2, 4 or 8. 0 is treated as 4.
+        public IntPtr weights1; // BoneWeight1[]. used instead of weights if not null
+        public IntPtr bones_per_vertex; // byte[]
+        public SkinningMethod skinning_method;
     }
 #endif // UNITY_EDITOR
 
@@ -519,14 +584,18 @@ namespace UTJ.NormalPainter
         }
 
 
+        // changed bones are stored to m_dirtyBones. m_rootMatrixDirty means all bones are affected.
         bool UpdateBoneMatrices()
         {
             bool ret = false;
+            m_dirtyBones.Clear();
+            m_rootMatrixDirty = false;
 
             var rootMatrix = GetComponent<Transform>().localToWorldMatrix;
             if (m_npSkinData.root != rootMatrix)
             {
                 m_npSkinData.root = rootMatrix;
+                m_rootMatrixDirty = true;
                 ret = true;
             }
 
@@ -537,6 +606,7 @@ namespace UTJ.NormalPainter
                 if (m_boneMatrices[i] != l2w)
                 {
                     m_boneMatrices[i] = l2w;
+                    m_dirtyBones.Add(i);
                     ret = true;
                 }
             }
@@ -546,15 +616,30 @@ namespace UTJ.NormalPainter
         void UpdateTransform()
         {
             m_npModelData.transform = GetComponent<Transform>().localToWorldMatrix;
+            npUpdateModel(m_npModel, ref m_npModelData);
 
             if (m_skinned && UpdateBoneMatrices())
             {
-                npApplySkinning(ref m_npSkinData,
-                    m_pointsPredeformed, m_normalsPredeformed, m_tangentsPredeformed,
-                    m_points, m_normals, m_tangents);
-                npApplySkinning(ref m_npSkinData,
-                    IntPtr.Zero, m_normalsBasePredeformed, m_tangentsBasePredeformed,
-                    IntPtr.Zero, m_normalsBase, m_tangentsBase);
+                if (m_rootMatrixDirty)
+                {
+                    npApplySkinning(ref m_npSkinData,
+                        m_pointsPredeformed, m_normalsPredeformed, m_tangentsPredeformed,
+                        m_points, m_normals, m_tangents);
+                    npApplySkinning(ref m_npSkinData,
+                        IntPtr.Zero, m_normalsBasePredeformed, m_tangentsBasePredeformed,
+                        IntPtr.Zero, m_normalsBase, m_tangentsBase);
+                }
+                else
+                {
+                    // re-skin only vertices influenced by moved bones
+                    var dirtyBones = m_dirtyBones.ToArray();
+                    npApplySkinningPartial(ref m_npSkinData, dirtyBones, dirtyBones.Length,
+                        m_pointsPredeformed, m_normalsPredeformed, m_tangentsPredeformed,
+                        m_points, m_normals, m_tangents);
+                    npApplySkinningPartial(ref m_npSkinData, dirtyBones, dirtyBones.Length,
+                        IntPtr.Zero, m_normalsBasePredeformed, m_tangentsBasePredeformed,
+                        IntPtr.Zero, m_normalsBase, m_tangentsBase);
+                }
 
                 if (m_cbPoints != null) m_cbPoints.SetData(m_points.List);
                 if (m_cbNormals != null) m_cbNormals.SetData(m_normals.List);
@@ -725,6 +810,7 @@ namespace UTJ.NormalPainter
         {
             for (int i = 0; i < m_selection.Count; ++i)
                 m_selection[i] = 1.0f;
+            MarkSelectionDirty();
             return m_selection.Count > 0;
         }
 
@@ -732,15 +818,24 @@ namespace UTJ.NormalPainter
         {
             for (int i = 0; i < m_selection.Count; ++i)
                 m_selection[i] = 1.0f - m_selection[i];
+            MarkSelectionDirty();
             return m_selection.Count > 0;
         }
 
         public bool ClearSelection()
         {
             System.Array.Clear(m_selection.Array, 0, m_selection.Count);
+            MarkSelectionDirty();
             return m_selection.Count > 0;
         }
 
+        // native side keeps an index of selected vertices and updates it in npSelect*.
+        // it must be notified when m_selection is modified by others.
+        void MarkSelectionDirty()
+        {
+            npMarkModelDirty(m_npModel, npDirtySelection);
+        }
+
         public static Vector2 ScreenCoord11(Vector2 v)
         {
             var cam = SceneView.lastActiveSceneView.camera;
@@ -1053,10 +1148,10 @@ namespace UTJ.NormalPainter
             return true;
         }
 
-        public void ApplySmoothing(float radius, float strength, bool pushUndo)
+        public void ApplySmoothing(float radius, float strength, int iterations, bool pushUndo)
         {
             bool mask = m_numSelected > 0;
-            npSmooth(ref m_npModelData, radius, strength, mask);
+            npSmooth(ref m_npModelData, radius, strength, iterations, mask);
 
             UpdateNormals();
             if (pushUndo) PushUndo();
@@ -1134,6 +1229,7 @@ namespace UTJ.NormalPainter
                     d.skinData.num_vertices = d.vertices.Count;
                     d.skinData.num_bones = d.bindposes.Count;
                     d.skinData.weights = d.weights;
+                    d.skinData.influences_per_vertex = 4;
                     d.skinData.bindposes = d.bindposes;
                     d.skinData.bones = d.bones;
                     d.skinData.root = d.transform;
@@ -1315,6 +1411,14 @@ namespace UTJ.NormalPainter
             AssetDatabase.CreateAsset(Instantiate(m_settings), path);
         }
 
+        const int npDirtyPoints = 0x1;
+        const int npDirtyTopology = 0x2;
+        const int npDirtySelection = 0x4;
+        [DllImport("NormalPainterCore")] static extern IntPtr npCreateModel(ref npMeshData data);
+        [DllImport("NormalPainterCore")] static extern void npUpdateModel(IntPtr model, ref npMeshData data);
+        [DllImport("NormalPainterCore")] static extern void npMarkModelDirty(IntPtr model, int flags);
+        [DllImport("NormalPainterCore")] static extern void npDestroyModel(IntPtr model);
+
         [DllImport("NormalPainterCore")] static extern int npRaycast(
             ref npMeshData model, Vector3 pos, Vector3 dir, ref int tindex, ref float distance);
 
@@ -1397,7 +1501,7 @@ namespace UTJ.NormalPainter
             ref npMeshData model, Vector3 amount, Vector3 pivotPos, Quaternion pivotRot);
 
         [DllImport("NormalPainterCore")] static extern int npSmooth(
-            ref npMeshData model, float radius, float strength, bool mask);
+            ref npMeshData model, float radius, float strength, int iterations, bool mask);
 
         [DllImport("NormalPainterCore")] static extern int npWeld(
             ref npMeshData model, bool smoothing, float weldAngle, bool mask);
@@ -1421,6 +1525,11 @@ namespace UTJ.NormalPainter
             IntPtr ipoints, IntPtr inormals, IntPtr itangents,
             IntPtr opoints, IntPtr onormals, IntPtr otangents);
 
+        [DllImport("NormalPainterCore")] static extern void npApplySkinningPartial(
+            ref npSkinData skin, int[] bones, int num_bones,
+            IntPtr ipoints, IntPtr inormals, IntPtr itangents,
+            IntPtr opoints, IntPtr onormals, IntPtr otangents);
+
         [DllImport("NormalPainterCore")] static extern void npApplyReverseSkinning(
             ref npSkinData skin,
             IntPtr ipoints, IntPtr inormals, IntPtr itangents,